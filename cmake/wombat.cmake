@@ -1,9 +1,12 @@
-set(API src/io/file.cpp src/io/image.cpp src/io/sample.cpp src/io/stream.cpp)
-set(IO src/api/console.cpp src/api/game.cpp src/api/keyboard.cpp src/api/mouse.cpp src/api/graphics.cpp src/api/image.cpp src/api/music.cpp src/api/sound.cpp )
-set(CORE src/Game.cpp src/js.cpp)
+set(API src/io/file.cpp src/io/archive.cpp src/io/loader.cpp src/io/cache.cpp src/io/image.cpp src/io/sample.cpp src/io/resample.cpp src/io/stream.cpp)
+set(IO src/api/console.cpp src/api/game.cpp src/api/keyboard.cpp src/api/mouse.cpp src/api/graphics.cpp src/api/image.cpp src/api/layer.cpp src/api/music.cpp src/api/sound.cpp src/api/mixer.cpp )
+set(RENDER src/render/render.cpp src/render/batch.cpp src/render/prim.cpp src/render/transform.cpp src/render/atlas.cpp)
+set(MIX src/mix/bus.cpp src/mix/channel.cpp)
+set(CORE src/Game.cpp src/js.cpp src/bench.cpp)
 
 ADD_DEFINITIONS(-g -Wall -W -Wpointer-arith -Wcast-qual -ggdb)
-add_executable(wombat src/main.cpp ${CORE} ${API} ${IO})
+add_executable(wombat src/main.cpp ${CORE} ${API} ${IO} ${RENDER} ${MIX})
+add_executable(wombat-pack tools/pack.cpp)
 
 LINK_DIRECTORIES(${CMAKE_BINARY_DIR}/res)
 target_link_libraries(wombat v8 allegro allegro_memfile allegro_primitives allegro_image allegro_audio allegro_acodec)
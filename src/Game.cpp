@@ -18,6 +18,9 @@
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 // THE SOFTWARE.
 #include "Game.h"
+#include <algorithm>
+#include <math.h>
+#include <string.h>
 
 // Game Namespace -------------------------------------------------------------
 namespace Game {
@@ -27,6 +30,7 @@ namespace Game {
     ModuleMap *moduleCache;
 
     // State
+    Options options = { false, 0, 0, "" };
     Allegro allegro = { NULL, NULL, NULL, NULL, NULL, NULL };
     JS js;
     State state;
@@ -34,6 +38,9 @@ namespace Game {
     Mouse mouse;
     Keyboard keyboard;
     Graphics graphics;
+    Stats stats;
+    Memory memory;
+    Audio audio;
 
     // Methods ----------------------------------------------------------------
     // ------------------------------------------------------------------------
@@ -64,6 +71,9 @@ namespace Game {
 
         }
 
+        // Assets are resolved through <main>.pak first if there is one
+        io::archive::open(state.main + ".pak");
+
         reset();
 
         if (!initJS() || !initAllegro()) {
@@ -103,6 +113,8 @@ namespace Game {
         js.image = JSObject();
         js.music = JSObject();
         js.sound = JSObject();
+        js.mixer = JSObject();
+        js.layer = JSObject();
 
         // Initiate Object Templates
         templates.position = v8::Persistent<v8::ObjectTemplate>::New(v8::ObjectTemplate::New());
@@ -119,6 +131,10 @@ namespace Game {
         setNumberProp(templates.color, "b", 1);
         setNumberProp(templates.color, "a", 1);
 
+        // Handles carry their type and a pointer to the native resource
+        templates.handle = v8::Persistent<v8::ObjectTemplate>::New(v8::ObjectTemplate::New());
+        templates.handle->SetInternalFieldCount(2);
+
         // Initiate APIs and IO
         api::game::init(js.game);
         api::console::init(js.console);
@@ -128,6 +144,15 @@ namespace Game {
         api::image::init(js.image);
         api::music::init(js.music);
         api::sound::init(js.sound);
+        api::mixer::init(js.mixer);
+        api::layer::init(js.layer);
+
+        // Initiate Renderer
+        render::batch::init();
+        render::prim::init();
+        render::transform::init();
+        render::atlas::init();
+        io::loader::init();
 
         // Expose mapped API to JavaScript
         setProp(js.global, "console", js.console);
@@ -139,6 +164,8 @@ namespace Game {
         setProp(js.global, "image", js.image);
         setProp(js.global, "music", js.music);
         setProp(js.global, "sound", js.sound);
+        setProp(js.global, "mixer", js.mixer);
+        setProp(js.global, "layer", js.layer);
         setFunctionProp(js.global, "require", require);
 
 
@@ -149,6 +176,8 @@ namespace Game {
         allegro.timer = NULL;
         //allegro.display = NULL;
         allegro.background = NULL;
+        allegro.mixer = NULL;
+        allegro.voice = NULL;
 
         // State and Time
         state.running = false;
@@ -161,6 +190,12 @@ namespace Game {
         printf("reset state... \n");
         time.time = 0;
         time.delta = 0;
+        time.accumulator = 0;
+        time.alpha = 1;
+        time.frame = 0;
+        time.fixedStep = false;
+        time.maxSteps = 5;
+        bench::reset();
 
         // Input
         mouse.x = 0;
@@ -182,6 +217,29 @@ namespace Game {
         graphics.lineWidth = 1;
         graphics.offsetX = 0;
         graphics.offsetY = 0;
+        graphics.viewX = 0;
+        graphics.viewY = 0;
+        graphics.viewWidth = graphics.width;
+        graphics.viewHeight = graphics.height;
+        graphics.atlas = true;
+        graphics.imageCache = false;
+
+        stats.draws = 0;
+        stats.culled = 0;
+        stats.batches = 0;
+
+        // Budgets in bytes, 0 means unlimited
+        memory.images.budget = 0;
+        memory.images.bytes = 0;
+        memory.images.count = 0;
+        memory.sounds = memory.images;
+        memory.music = memory.images;
+        memory.musicIdleTimeout = 30;
+
+        audio.maxVoices = 32;
+        audio.stealing = VOICE_STEAL_OLDEST;
+        audio.resample = false;
+        audio.frequency = 0;
 
         // Config object
         js.config->Set(v8::String::NewSymbol("title"), v8::String::New(graphics.title.data()));
@@ -189,6 +247,17 @@ namespace Game {
         setNumberProp(js.config, "height", graphics.height);
         setNumberProp(js.config, "scale", graphics.scale);
         setNumberProp(js.config, "fps", graphics.fps);
+        setProp(js.config, "atlas", v8::Boolean::New(graphics.atlas));
+        setProp(js.config, "imageCache", v8::Boolean::New(graphics.imageCache));
+        setProp(js.config, "fixedStep", v8::Boolean::New(time.fixedStep));
+        setNumberProp(js.config, "maxSteps", time.maxSteps);
+        setNumberProp(js.config, "imageBudget", memory.images.budget);
+        setNumberProp(js.config, "soundBudget", memory.sounds.budget);
+        setNumberProp(js.config, "musicBudget", memory.music.budget);
+        setNumberProp(js.config, "musicIdleTimeout", memory.musicIdleTimeout);
+        setNumberProp(js.config, "maxVoices", audio.maxVoices);
+        js.config->Set(v8::String::NewSymbol("voiceStealing"), v8::String::New("oldest"));
+        setProp(js.config, "resampleSounds", v8::Boolean::New(audio.resample));
 
         // Resources
         moduleCache = new ModuleMap();
@@ -215,208 +284,342 @@ namespace Game {
 
     int loop() {
 
-        double lastFrameTime, now = 0;
-        bool redraw ;
-        unsigned int i;
+        double lastFrameTime, now;
+        bool redraw, virtualClock;
+        int frames;
 
         v8::Context::Scope contextScope(js.context);
         v8::HandleScope scope;
-        v8::Handle<v8::Value> args[2];
 
         loopStart:
 
         debugMsg("loop", "Enter");
 
-        lastFrameTime = now;
-        now = 0;
+        // Headless and benchmark runs are driven by a virtual clock which
+        // advances by exactly one frame per iteration
+        virtualClock = options.headless || options.benchmark > 0;
+        lastFrameTime = virtualClock ? 0 : al_get_time();
+        now = lastFrameTime;
         redraw = false;
-        al_start_timer(allegro.timer);
+        frames = 0;
+        time.accumulator = 0;
         state.running = true;
 
+        if (!virtualClock) {
+            al_start_timer(allegro.timer);
+        }
+
         while (state.running) {
 
             ALLEGRO_EVENT event;
-            al_wait_for_event(allegro.eventQueue, &event);
+            if (virtualClock) {
 
-            // Handle Events
-            switch (event.type) {
-                case ALLEGRO_EVENT_DISPLAY_CLOSE:
-                    state.running = false;
-                    break;
+                bench::begin(BENCH_FRAME);
+                bench::begin(BENCH_EVENTS);
+                while (al_get_next_event(allegro.eventQueue, &event)) {
+                    handleEvent(event);
+                }
+                bench::end(BENCH_EVENTS);
 
-                case ALLEGRO_EVENT_KEY_DOWN:
-                    keyboard.state[event.keyboard.keycode] = 1;
-                    keyboard.pressedCount++;
-                    break;
-                
-                case ALLEGRO_EVENT_KEY_UP:
+                now += 1.0 / graphics.fps;
+                bench::begin(BENCH_UPDATE);
+                redraw = advance(now, now - lastFrameTime);
+                bench::end(BENCH_UPDATE);
+                lastFrameTime = now;
 
-                    keyboard.state[event.keyboard.keycode] = 0;
-                    keyboard.pressedCount--;
-                    if (keyboard.pressedCount < 0) {
-                        keyboard.pressedCount = 0;
-                    }
+            } else {
 
-                    break;
-                
-                case ALLEGRO_EVENT_MOUSE_AXES:
-                    mouse.x = event.mouse.x / graphics.scale;
-                    mouse.y = event.mouse.y / graphics.scale;
-                    break;
-                
-                case ALLEGRO_EVENT_MOUSE_BUTTON_DOWN:
-                    for(i = 0; i < 4; i++) {
-                        if (event.mouse.button & (1 << i)) {
-                            mouse.state[i + 1] = 1;
-                            mouse.pressedCount++;
-                        }
-                    }
-                    break;
-                
-                case ALLEGRO_EVENT_MOUSE_BUTTON_UP:
+                al_wait_for_event(allegro.eventQueue, &event);
+                if (event.type == ALLEGRO_EVENT_TIMER) {
 
-                    for(i = 0; i < 4; i++) {
-                        if (event.mouse.button & (1 << i)) {
-                            mouse.state[i + 1] = 0;
-                            mouse.pressedCount--;
+                    // Timer events which piled up while we were busy carry
+                    // no information the accumulator doesn't already have
+                    if (time.fixedStep) {
+                        while (al_peek_next_event(allegro.eventQueue, &event)
+                               && event.type == ALLEGRO_EVENT_TIMER) {
+                            al_drop_next_event(allegro.eventQueue);
                         }
                     }
 
-                    if (mouse.pressedCount < 0) {
-                        mouse.pressedCount = 0;
-                    }
+                    now = al_get_time();
+                    redraw = advance(now, now - lastFrameTime);
+                    lastFrameTime = now;
 
-                    break;
-                
-                case ALLEGRO_EVENT_MOUSE_ENTER_DISPLAY:
-                    mouse.hasFocus = true;
-                    break;
+                } else {
+                    handleEvent(event);
+                }
 
-                case ALLEGRO_EVENT_MOUSE_LEAVE_DISPLAY:
-                    mouse.hasFocus = false;
-                    break;
+            }
 
-                case ALLEGRO_EVENT_DISPLAY_SWITCH_IN:
-                    keyboard.hasFocus = true;
-                    break;
+            // Render 
+            if (redraw && al_is_event_queue_empty(allegro.eventQueue)) {
 
-                case ALLEGRO_EVENT_DISPLAY_SWITCH_OUT:
-                    keyboard.hasFocus = false;
-                    break;
+                draw();
+                redraw = false;
 
-                case ALLEGRO_EVENT_TIMER:
+                bench::end(BENCH_FRAME);
+                bench::frame();
 
-                    // Timer
-                    now = al_get_time();
-                    time.delta = now - lastFrameTime;
-                    if (state.paused) {
-                        time.delta = 0;
-                    }
+                frames++;
+                if (options.frames > 0 && frames >= options.frames) {
+                    debugArgs("loop", "Stopping after %d frames", frames);
+                    state.running = false;
+                }
 
-                    time.time += time.delta;
-                    lastFrameTime = now;
+            }
+
+        }
 
-                    // Check pending sample instances
-                    api::sound::update(now, time.delta);
-                    api::music::update(now, time.delta);
+        debugMsg("loop", "Leave");
 
-                    // Call Game Update Code
-                    args[0] = v8::Number::New(time.time);
-                    args[1] = v8::Number::New(time.delta);
-                    invoke("update", args, 2);
+        bench::report();
+        exit();
 
-                    // Update / Reset Input States
-                    for(i = 0; i < ALLEGRO_KEY_MAX; i++) {
-                        if (keyboard.state[i] == 1) {
-                            keyboard.state[i] = 2;
-                        }
-                        keyboard.stateOld[i] = keyboard.state[i];
+        if (state.fullReload) {
+            debugMsg("reset", "Full");
+            init(state.main);
+            goto loopStart;
+        }
+
+        return 0;
+ 
+    }
+
+    void handleEvent(const ALLEGRO_EVENT &event) {
+
+        unsigned int i;
+        switch (event.type) {
+            case ALLEGRO_EVENT_DISPLAY_CLOSE:
+                state.running = false;
+                break;
+
+            case ALLEGRO_EVENT_KEY_DOWN:
+                keyboard.state[event.keyboard.keycode] = 1;
+                keyboard.pressedCount++;
+                break;
+            
+            case ALLEGRO_EVENT_KEY_UP:
+
+                keyboard.state[event.keyboard.keycode] = 0;
+                keyboard.pressedCount--;
+                if (keyboard.pressedCount < 0) {
+                    keyboard.pressedCount = 0;
+                }
+
+                break;
+            
+            case ALLEGRO_EVENT_MOUSE_AXES:
+                mouse.x = event.mouse.x / graphics.scale;
+                mouse.y = event.mouse.y / graphics.scale;
+                break;
+            
+            case ALLEGRO_EVENT_MOUSE_BUTTON_DOWN:
+                for(i = 0; i < 4; i++) {
+                    if (event.mouse.button & (1 << i)) {
+                        mouse.state[i + 1] = 1;
+                        mouse.pressedCount++;
                     }
+                }
+                break;
+            
+            case ALLEGRO_EVENT_MOUSE_BUTTON_UP:
 
-                    for(i = 0; i < MAX_MOUSE; i++) {
-                        if (mouse.state[i] == 1) {
-                            mouse.state[i] = 2;
-                        }
-                        mouse.stateOld[i] = mouse.state[i];
-                    }   
-
-                    redraw = true;
-                    
-                    // Handle hot code reloading
-                    if (state.reload) {
-                        debugMsg("loop", "Reload modules...");
-                        redraw = false;
-                        state.reload = false;
-                        reset();
+                for(i = 0; i < 4; i++) {
+                    if (event.mouse.button & (1 << i)) {
+                        mouse.state[i + 1] = 0;
+                        mouse.pressedCount--;
                     }
-                    break;
+                }
+
+                if (mouse.pressedCount < 0) {
+                    mouse.pressedCount = 0;
+                }
 
-                default:
-                    break;
+                break;
+            
+            case ALLEGRO_EVENT_MOUSE_ENTER_DISPLAY:
+                mouse.hasFocus = true;
+                break;
+
+            case ALLEGRO_EVENT_MOUSE_LEAVE_DISPLAY:
+                mouse.hasFocus = false;
+                break;
+
+            case ALLEGRO_EVENT_DISPLAY_SWITCH_IN:
+                keyboard.hasFocus = true;
+                break;
+
+            case ALLEGRO_EVENT_DISPLAY_SWITCH_OUT:
+                keyboard.hasFocus = false;
+                break;
+
+            default:
+                break;
+
+        }
 
+    }
+
+    bool advance(double now, double delta) {
+
+        // Variable timestep, the simulation is always up to date
+        if (!time.fixedStep) {
+            time.alpha = 1;
+            return tick(now, delta);
+        }
+
+        double step = 1.0 / graphics.fps;
+        int steps = 0;
+
+        // The virtual clock advances by exactly one step, rounding must not
+        // leave it a hair short of it
+        double epsilon = options.headless || options.benchmark > 0 ? step * 1e-6 : 0;
+
+        time.accumulator += delta;
+        while (time.accumulator + epsilon >= step) {
+
+            // Give up on catching up instead of spiralling further behind
+            if (steps == time.maxSteps) {
+                debugArgs("loop", "Skipped %d update(s)", (int)(time.accumulator / step));
+                time.accumulator = fmod(time.accumulator, step);
+                break;
             }
 
-            // Render 
-            if (redraw && al_is_event_queue_empty(allegro.eventQueue)) {
+            if (!tick(now, step)) {
+                time.accumulator = 0;
+                time.alpha = 1;
+                return false;
+            }
+
+            time.accumulator = std::max(time.accumulator - step, 0.0);
+            steps++;
 
-                // Handle resizing
-                if (graphics.wasResized) {
+        }
 
-                    debugMsg("loop", "Resize display...");
-                    al_resize_display(allegro.display, graphics.width * graphics.scale, graphics.height * graphics.scale);
+        // How far we are between the last and the next simulation step, a
+        // frame is drawn even without a step so the interpolation shows
+        time.alpha = time.accumulator / step;
+        return true;
 
-                    if (allegro.background != NULL) {
-                        al_destroy_bitmap(allegro.background);
-                    }
+    }
 
-                    if (graphics.scale != 1) {
-                        allegro.background = al_create_bitmap(graphics.width, graphics.height);
-                        al_set_target_bitmap(allegro.background);
+    bool tick(double now, double delta) {
 
-                    } else {
-                        al_set_target_bitmap(al_get_backbuffer(allegro.display));
-                    }
+        unsigned int i;
+        v8::Handle<v8::Value> args[2];
 
-                    graphics.wasResized = false;
+        // Timer
+        time.delta = state.paused ? 0 : delta;
+        time.time += time.delta;
 
-                }
+        // Hand finished async loads to the game
+        io::loader::update();
+        api::game::update();
 
-                if (graphics.scale != 1) {
-                    al_set_target_bitmap(allegro.background);
-                }
+        // Check pending sample instances
+        api::sound::update(now, time.delta);
+        api::music::update(now, time.delta);
+
+        // Call Game Update Code
+        args[0] = v8::Number::New(time.time);
+        args[1] = v8::Number::New(time.delta);
+        invoke("update", args, 2);
+
+        // Update / Reset Input States
+        for(i = 0; i < ALLEGRO_KEY_MAX; i++) {
+            if (keyboard.state[i] == 1) {
+                keyboard.state[i] = 2;
+            }
+            keyboard.stateOld[i] = keyboard.state[i];
+        }
+
+        for(i = 0; i < MAX_MOUSE; i++) {
+            if (mouse.state[i] == 1) {
+                mouse.state[i] = 2;
+            }
+            mouse.stateOld[i] = mouse.state[i];
+        }   
+
+        // Handle hot code reloading
+        if (state.reload) {
+            debugMsg("loop", "Reload modules...");
+            state.reload = false;
+            bench::reset();
+            reset();
+            return false;
+        }
+
+        return true;
+
+    }
+
+    void draw() {
+
+        v8::Handle<v8::Value> args[2];
+
+        // Handle resizing
+        if (graphics.wasResized) {
 
-                al_clear_to_color(graphics.bgColor);
+            debugMsg("loop", "Resize display...");
+            if (allegro.background != NULL) {
+                al_destroy_bitmap(allegro.background);
+                allegro.background = NULL;
+            }
+
+            if (options.headless) {
+                allegro.background = al_create_bitmap(graphics.width, graphics.height);
+                al_set_target_bitmap(allegro.background);
+
+            } else {
 
-                // Call Game Render Code
-                args[0] = v8::Number::New(time.time);
-                invoke("render", args, 1);
+                al_resize_display(allegro.display, graphics.width * graphics.scale, graphics.height * graphics.scale);
 
-                // Scale up if necessary
                 if (graphics.scale != 1) {
+                    allegro.background = al_create_bitmap(graphics.width, graphics.height);
+                    al_set_target_bitmap(allegro.background);
+
+                } else {
                     al_set_target_bitmap(al_get_backbuffer(allegro.display));
-                    al_draw_scaled_bitmap(allegro.background, 0, 0, graphics.width, graphics.height, 0, 0, 
-                                          graphics.width * graphics.scale, graphics.height * graphics.scale, 0);
                 }
 
-                al_flip_display();
-                redraw = false;
-
             }
 
+            graphics.wasResized = false;
+
         }
 
-        debugMsg("loop", "Leave");
+        if (allegro.background != NULL) {
+            al_set_target_bitmap(allegro.background);
+        }
 
-        exit();
+        bench::begin(BENCH_RENDER);
+        time.frame++;
+        al_clear_to_color(graphics.bgColor);
+        render::begin();
+
+        // Call Game Render Code
+        args[0] = v8::Number::New(time.time);
+        args[1] = v8::Number::New(time.alpha);
+        invoke("render", args, 2);
+        render::flush();
+        bench::end(BENCH_RENDER);
+
+        // Nothing to present without a display
+        if (options.headless) {
+            return;
+        }
 
-        if (state.fullReload) {
-            debugMsg("reset", "Full");
-            init(state.main);
-            goto loopStart;
+        // Scale up if necessary
+        bench::begin(BENCH_FLIP);
+        if (graphics.scale != 1) {
+            al_set_target_bitmap(al_get_backbuffer(allegro.display));
+            al_draw_scaled_bitmap(allegro.background, 0, 0, graphics.width, graphics.height, 0, 0, 
+                                  graphics.width * graphics.scale, graphics.height * graphics.scale, 0);
         }
 
-        return 0;
- 
+        al_flip_display();
+        bench::end(BENCH_FLIP);
+
     }
 
     void exit() {
@@ -431,9 +634,17 @@ namespace Game {
         delete moduleCache;
 
         debugMsg("exit", "Shutdown API and IO");
+        io::loader::shutdown();
+        api::game::shutdown();
         api::image::shutdown();
         api::music::shutdown();
         api::sound::shutdown();
+        api::layer::shutdown();
+        render::batch::shutdown();
+        render::prim::shutdown();
+        render::transform::shutdown();
+        render::atlas::shutdown();
+        io::archive::close();
 
         // Cleanup APIs
         debugMsg("exit", "Destroy JS");
@@ -446,11 +657,14 @@ namespace Game {
         js.image.Dispose();
         js.music.Dispose();
         js.sound.Dispose();
+        js.mixer.Dispose();
+        js.layer.Dispose();
         
         // Remove templates
         templates.position.Dispose();
         templates.size.Dispose();
         templates.color.Dispose();
+        templates.handle.Dispose();
         
         // Remove context
         js.global.Dispose();
@@ -461,6 +675,9 @@ namespace Game {
         // Clean up allegro ---------------------------------------------------
         debugMsg("exit", "Destroy Allegro");
         if (allegro.mixer) {
+            mix::bus::shutdown();
+            io::resample::shutdown();
+            audio.frequency = 0;
             al_destroy_mixer(allegro.mixer);
         }
 
@@ -472,7 +689,7 @@ namespace Game {
             al_destroy_bitmap(allegro.background);
         }
 
-        if (!state.fullReload) {
+        if (!state.fullReload && allegro.display) {
             al_destroy_display(allegro.display);
         }
 
@@ -480,7 +697,10 @@ namespace Game {
         al_uninstall_mouse();
         al_uninstall_keyboard();
 
-        al_destroy_timer(allegro.timer);
+        if (allegro.timer) {
+            al_destroy_timer(allegro.timer);
+        }
+
         al_destroy_event_queue(allegro.eventQueue);
 
         if (!state.fullReload) {
@@ -505,6 +725,24 @@ namespace Game {
         graphics.height = ToInt32(js.config->Get(v8::String::New("height")));
         graphics.scale = ToInt32(js.config->Get(v8::String::New("scale")));
         graphics.fps = ToInt32(js.config->Get(v8::String::New("fps")));
+        graphics.atlas = ToBoolean(js.config->Get(v8::String::New("atlas")));
+        graphics.imageCache = ToBoolean(js.config->Get(v8::String::New("imageCache")));
+        time.fixedStep = ToBoolean(js.config->Get(v8::String::New("fixedStep")));
+        time.maxSteps = ToInt32(js.config->Get(v8::String::New("maxSteps")));
+        memory.images.budget = (int64_t)js.config->Get(v8::String::New("imageBudget"))->NumberValue();
+        memory.sounds.budget = (int64_t)js.config->Get(v8::String::New("soundBudget"))->NumberValue();
+        memory.music.budget = (int64_t)js.config->Get(v8::String::New("musicBudget"))->NumberValue();
+        memory.musicIdleTimeout = js.config->Get(v8::String::New("musicIdleTimeout"))->NumberValue();
+        audio.maxVoices = ToInt32(js.config->Get(v8::String::New("maxVoices")));
+        audio.resample = ToBoolean(js.config->Get(v8::String::New("resampleSounds")));
+
+        v8::String::Utf8Value stealing(js.config->Get(v8::String::New("voiceStealing")));
+        if (strcmp(*stealing, "quietest") == 0) {
+            audio.stealing = VOICE_STEAL_QUIETEST;
+
+        } else {
+            audio.stealing = VOICE_STEAL_OLDEST;
+        }
 
         v8::String::Utf8Value text(js.config->Get(v8::String::New("title")));
         graphics.title.clear();
@@ -521,6 +759,14 @@ namespace Game {
         } else if (graphics.fps <= 0 || graphics.fps > 60) {
             debugMsg("initJS", "Invalid graphics.fps");
             return false;
+
+        } else if (time.maxSteps <= 0) {
+            debugMsg("initJS", "Invalid time.maxSteps");
+            return false;
+
+        } else if (audio.maxVoices <= 0 || audio.maxVoices > 256) {
+            debugMsg("initJS", "Invalid audio.maxVoices");
+            return false;
         }
 
         return true;
@@ -545,9 +791,34 @@ namespace Game {
             return false;
         }
 
-        allegro.timer = al_create_timer(1.0 / graphics.fps);
         allegro.eventQueue = al_create_event_queue();
 
+        graphics.color = al_map_rgba(255, 255, 255, 255); 
+        graphics.bgColor = al_map_rgba(0, 0, 0, 255); 
+        graphics.blendColor = al_map_rgba(255, 255, 255, 255); 
+
+        al_set_blender(ALLEGRO_ADD, ALLEGRO_ALPHA, ALLEGRO_INVERSE_ALPHA);
+
+        // Without a display everything renders into memory bitmaps and
+        // there's no input, timer or audio output
+        if (options.headless) {
+
+            debugMsg("initAllegro", "Running headless");
+            al_set_new_bitmap_flags(ALLEGRO_MEMORY_BITMAP);
+
+            allegro.background = al_create_bitmap(graphics.width, graphics.height);
+            if (allegro.background == NULL) {
+                debugMsg("initAllegro", "al_create_bitmap() failed");
+                return false;
+            }
+
+            al_set_target_bitmap(allegro.background);
+            return initAudio();
+
+        }
+
+        allegro.timer = al_create_timer(1.0 / graphics.fps);
+
         keyboard.hasFocus = true;
         al_install_keyboard();
         al_install_mouse();
@@ -559,6 +830,10 @@ namespace Game {
 
         // Setup Display ------------------------------------------------------
         if (!allegro.display) {
+
+            // Display options only affect displays created after them;
+            // benchmarks must not be throttled by vsync
+            al_set_new_display_option(ALLEGRO_VSYNC, options.benchmark > 0 ? 2 : 1, ALLEGRO_SUGGEST);
             
             allegro.display = al_create_display(graphics.width * graphics.scale, graphics.height * graphics.scale);
             if (allegro.display == NULL) {
@@ -568,7 +843,6 @@ namespace Game {
 
         }
 
-        al_set_new_display_option(ALLEGRO_VSYNC, true, ALLEGRO_SUGGEST);
         al_set_window_title(allegro.display, graphics.title.data());
         al_register_event_source(allegro.eventQueue, al_get_display_event_source(allegro.display));
 
@@ -582,28 +856,54 @@ namespace Game {
             al_set_target_bitmap(al_get_backbuffer(allegro.display));
         }
 
-        graphics.color = al_map_rgba(255, 255, 255, 255); 
-        graphics.bgColor = al_map_rgba(0, 0, 0, 255); 
-        graphics.blendColor = al_map_rgba(255, 255, 255, 255); 
 
-        al_set_blender(ALLEGRO_ADD, ALLEGRO_ALPHA, ALLEGRO_INVERSE_ALPHA);
+        // Setup Audio --------------------------------------------------------
+        return initAudio();
+ 
+    }
 
+    bool initAudio() {
 
-        // Setup Audio --------------------------------------------------------
-        if (!al_install_audio() || !al_init_acodec_addon()) {
-            debugMsg("initAllegro", "al_init_audio() failed");
+        // Headless runs still load and mix audio, so scripts take the same
+        // paths as usual, but the mixer isn't attached to an output voice
+        if (!al_install_audio()) {
+
+            if (options.headless) {
+                debugMsg("initAudio", "al_install_audio() failed, running without audio");
+                return true;
+            }
+
+            debugMsg("initAudio", "al_install_audio() failed");
             return false;
+
+        }
+
+        if (!al_init_acodec_addon()) {
+            debugMsg("initAudio", "al_init_acodec_addon() failed");
+            if (!options.headless) {
+                return false;
+            }
         }
 
-        allegro.voice = al_create_voice(44100, ALLEGRO_AUDIO_DEPTH_INT16, ALLEGRO_CHANNEL_CONF_2);
         allegro.mixer = al_create_mixer(44100, ALLEGRO_AUDIO_DEPTH_INT16, ALLEGRO_CHANNEL_CONF_2);
+        if (!options.headless) {
+            allegro.voice = al_create_voice(44100, ALLEGRO_AUDIO_DEPTH_INT16, ALLEGRO_CHANNEL_CONF_2);
+            al_attach_mixer_to_voice(allegro.mixer, allegro.voice);
+        }
 
-        al_attach_mixer_to_voice(allegro.mixer, allegro.voice);
         if (!al_set_default_mixer(allegro.mixer)) {
-            debugMsg("initAllegro", "al_set_default_mixer() failed");
+            debugMsg("initAudio", "al_set_default_mixer() failed");
             return false;
         }
 
+        mix::bus::init(allegro.mixer);
+
+        // Samples are converted while loading, to what the mixer runs at
+        audio.frequency = al_get_mixer_frequency(allegro.mixer);
+        if (audio.resample) {
+            io::resample::init();
+        }
+
         return true;
  
     }
@@ -622,27 +922,61 @@ namespace Game {
         v8::Handle<v8::Value> object = js.game->Get(v8::String::NewSymbol(name));
         
         if (object->IsFunction()) {
+            return call(v8::Handle<v8::Function>::Cast(object), args, argc);
+        
+        } else {
+            return false;
+        }
 
-            v8::TryCatch t;
+    }
 
-            v8::Handle<v8::Function> func = v8::Handle<v8::Function>::Cast(object);
-            func->Call(js.global, argc, args);
+    bool call(const v8::Handle<v8::Function> &func, v8::Handle<v8::Value> *args, int argc) {
 
-            if (t.HasCaught()) {
-                handleException(t);
-                state.error = true;
-                return false;
+        if (state.error) {
+            return false;
+        }
 
-            } else {
-                return true;
-            }
-        
-        } else {
+        v8::Context::Scope contextScope(js.context);
+        v8::HandleScope scope;
+        v8::TryCatch t;
+
+        func->Call(js.global, argc, args);
+
+        if (t.HasCaught()) {
+            handleException(t);
+            state.error = true;
             return false;
+
+        } else {
+            return true;
         }
 
     }
 
+    v8::Handle<v8::Object> wrapHandle(HANDLE_TYPE type, void *ptr, const std::string name) {
+
+        v8::HandleScope scope;
+        v8::Handle<v8::Object> handle = templates.handle->NewInstance();
+        handle->SetInternalField(0, v8::Integer::New(type));
+        handle->SetPointerInInternalField(1, ptr);
+        handle->Set(v8::String::NewSymbol("name"), v8::String::New(name.data()));
+        return scope.Close(handle);
+
+    }
+
+    void *unwrapHandle(const v8::Handle<v8::Value> &value, HANDLE_TYPE type) {
+
+        if (value->IsObject()) {
+            v8::Handle<v8::Object> handle = v8::Handle<v8::Object>::Cast(value);
+            if (handle->InternalFieldCount() == 2 && handle->GetInternalField(0)->Int32Value() == type) {
+                return handle->GetPointerFromInternalField(1);
+            }
+        }
+
+        return NULL;
+
+    }
+
     v8::Handle<v8::Value> require(const v8::Arguments& args) {
         if (args.Length() >= 0) {
             return Game::requireModule(ToString(args[0]));
@@ -51,6 +51,84 @@ namespace Game {
 
     // Type Declarations ------------------------------------------------------
     typedef std::map<const std::string, v8::Persistent<v8::Value> > ModuleMap;
+    typedef std::vector<v8::Persistent<v8::Function> > CallbackList;
+
+    typedef enum HANDLE_TYPE {
+        HANDLE_IMAGE = 1,
+        HANDLE_SOUND = 2,
+        HANDLE_MUSIC = 3
+
+    } HANDLE_TYPE;
+
+    typedef struct {
+        bool headless;
+        int frames;
+        int benchmark;
+        std::string report;
+
+    } Options;
+
+    typedef enum BENCH_PHASE {
+        BENCH_EVENTS = 0,
+        BENCH_UPDATE,
+        BENCH_RENDER,
+        BENCH_FLIP,
+        BENCH_FRAME,
+        BENCH_PHASES
+
+    } BENCH_PHASE;
+
+    typedef enum FILE_BUFFER_TYPE {
+        FILE_BUFFER_HEAP = 0,
+        FILE_BUFFER_MAPPED,
+        FILE_BUFFER_ARCHIVE
+
+    } FILE_BUFFER_TYPE;
+
+    typedef struct {
+        void *data;
+        int64_t size;
+        FILE_BUFFER_TYPE type;
+
+    } FileBuffer;
+
+    typedef enum LOAD_TYPE {
+        LOAD_IMAGE = 0,
+        LOAD_SAMPLE,
+        LOAD_STREAM
+
+    } LOAD_TYPE;
+
+    typedef enum VOICE_STEALING {
+        VOICE_STEAL_OLDEST = 0,
+        VOICE_STEAL_QUIETEST
+
+    } VOICE_STEALING;
+
+    typedef enum AUDIO_BUS {
+        BUS_MUSIC = 0,
+        BUS_SFX,
+        BUS_UI,
+        BUS_VOICE,
+        BUS_COUNT
+
+    } AUDIO_BUS;
+
+    typedef enum CHANNEL_PARAM {
+        CHANNEL_GAIN = 0,
+        CHANNEL_PAN,
+        CHANNEL_PARAMS
+
+    } CHANNEL_PARAM;
+
+    typedef enum RAMP_CURVE {
+        RAMP_LINEAR = 0,
+        RAMP_EXPONENTIAL
+
+    } RAMP_CURVE;
+
+    // Receives the loaded resource, or NULL, on the main thread
+    typedef void (*LoadCallback)(void *result, void *data);
 
     typedef struct {
         ALLEGRO_DISPLAY *display;
@@ -74,6 +152,8 @@ namespace Game {
         v8::Persistent<v8::Object> image;
         v8::Persistent<v8::Object> music;
         v8::Persistent<v8::Object> sound;
+        v8::Persistent<v8::Object> mixer;
+        v8::Persistent<v8::Object> layer;
         
     } JS;        
 
@@ -90,6 +170,11 @@ namespace Game {
     typedef struct {
         double time;
         double delta;
+        double accumulator;
+        double alpha;
+        unsigned int frame;
+        bool fixedStep;
+        int maxSteps;
 
     } Time;
 
@@ -120,6 +205,12 @@ namespace Game {
         int lineWidth;
         int offsetX;
         int offsetY;
+        float viewX;
+        float viewY;
+        float viewWidth;
+        float viewHeight;
+        bool atlas;
+        bool imageCache;
         ALLEGRO_COLOR color;
         ALLEGRO_COLOR bgColor;
         ALLEGRO_COLOR blendColor;
@@ -128,10 +219,41 @@ namespace Game {
 
     } Graphics;
 
+    typedef struct {
+        int draws;
+        int culled;
+        int batches;
+
+    } Stats;
+
+    typedef struct {
+        int64_t budget;
+        int64_t bytes;
+        int count;
+
+    } AssetMemory;
+
+    typedef struct {
+        AssetMemory images;
+        AssetMemory sounds;
+        AssetMemory music;
+        double musicIdleTimeout;
+
+    } Memory;
+
+    typedef struct {
+        int maxVoices;
+        VOICE_STEALING stealing;
+        bool resample;
+        unsigned int frequency;
+
+    } Audio;
+
     typedef struct {
         v8::Persistent<v8::ObjectTemplate> position;
         v8::Persistent<v8::ObjectTemplate> size;
         v8::Persistent<v8::ObjectTemplate> color;
+        v8::Persistent<v8::ObjectTemplate> handle;
         
     } Templates;
 
@@ -141,6 +263,7 @@ namespace Game {
     extern ModuleMap *moduleCache;
 
     // State
+    extern Options options;
     extern Allegro allegro;
     extern JS js;
     extern State state;
@@ -148,6 +271,9 @@ namespace Game {
     extern Mouse mouse;
     extern Keyboard keyboard;
     extern Graphics graphics;
+    extern Stats stats;
+    extern Memory memory;
+    extern Audio audio;
 
 
     // Methods ----------------------------------------------------------------
@@ -155,12 +281,20 @@ namespace Game {
     void setup();
     void reset();
     int loop();
+    void handleEvent(const ALLEGRO_EVENT &event);
+    bool advance(double now, double delta);
+    bool tick(double now, double delta);
+    void draw();
     void exit();
 
     bool initAllegro();
+    bool initAudio();
     bool initJS();
 
     bool invoke(const char *name, v8::Handle<v8::Value> *args, int argc);
+    bool call(const v8::Handle<v8::Function> &func, v8::Handle<v8::Value> *args, int argc);
+    v8::Handle<v8::Object> wrapHandle(HANDLE_TYPE type, void *ptr, const std::string name);
+    void *unwrapHandle(const v8::Handle<v8::Value> &value, HANDLE_TYPE type);
     v8::Handle<v8::Value> require(const v8::Arguments& args);
     v8::Handle<v8::Value> requireModule(std::string module);
 
@@ -176,6 +310,8 @@ namespace Game {
 
         namespace game {
             void init(const v8::Handle<v8::Object> &object);
+            void update();
+            void shutdown();
         }
 
         namespace keyboard {
@@ -191,30 +327,155 @@ namespace Game {
         }
 
         namespace image {
+            void init(const v8::Handle<v8::Object> &object);
+            void preload(const std::string filename);
+            void shutdown();
+        }
+
+        namespace layer {
             void init(const v8::Handle<v8::Object> &object);
             void shutdown();
         }
 
         namespace sound {
             void init(const v8::Handle<v8::Object> &object);
+            void preload(const std::string filename);
             void update(double time, double dt);
             void shutdown();
         }
 
         namespace music {
             void init(const v8::Handle<v8::Object> &object);
+            void preload(const std::string filename);
             void update(double time, double dt);
             void shutdown();
         }
 
+        namespace mixer {
+            void init(const v8::Handle<v8::Object> &object);
+        }
+
+    }
+
+    // Mixing -----------------------------------------------------------------
+    namespace mix {
+
+        namespace bus {
+            void init(ALLEGRO_MIXER *parent);
+            ALLEGRO_MIXER *mixer(AUDIO_BUS bus);
+            int find(const std::string name);
+            const char *name(AUDIO_BUS bus);
+            void setGain(AUDIO_BUS bus, float gain, float duration);
+            float getGain(AUDIO_BUS bus);
+            void duck(AUDIO_BUS bus, AUDIO_BUS by, float level, float attack, float release);
+            void unduck(AUDIO_BUS bus);
+            void shutdown();
+        }
+
+        namespace channel {
+            struct Channel;
+            Channel *create(AUDIO_BUS bus, float gain, float pan);
+            ALLEGRO_MIXER *mixer(Channel *c);
+            void attach(Channel *c, AUDIO_BUS bus);
+            void detach(Channel *c);
+            void set(Channel *c, CHANNEL_PARAM param, float to, float duration, RAMP_CURVE curve);
+            void ramp(Channel *c, CHANNEL_PARAM param, float from, float to, float duration, RAMP_CURVE curve);
+            float get(Channel *c, CHANNEL_PARAM param);
+            RAMP_CURVE curve(const std::string name);
+            void destroy(Channel *c);
+        }
+
+    }
+
+    // Benchmarking -----------------------------------------------------------
+    namespace bench {
+        void begin(BENCH_PHASE phase);
+        void end(BENCH_PHASE phase);
+        void frame();
+        void report();
+        void reset();
+    }
+
+    // Rendering --------------------------------------------------------------
+    namespace render {
+
+        void begin();
+        bool visible(float x1, float y1, float x2, float y2);
+        void flush();
+
+        namespace batch {
+            void init();
+            void draw(ALLEGRO_BITMAP *bitmap, float sx, float sy, float sw, float sh,
+                      float dx, float dy, ALLEGRO_COLOR tint, int flags);
+            void flush();
+            void shutdown();
+        }
+
+        namespace prim {
+            void init();
+            void line(float x1, float y1, float x2, float y2, ALLEGRO_COLOR color, float thickness);
+            void rect(float x1, float y1, float x2, float y2, ALLEGRO_COLOR color, float thickness);
+            void filledRect(float x1, float y1, float x2, float y2, ALLEGRO_COLOR color);
+            void flush();
+            void shutdown();
+        }
+
+        namespace transform {
+            void init();
+            void reset();
+            void apply();
+            void push();
+            unsigned int depth();
+            bool pop();
+            void identity();
+            void translate(float x, float y);
+            void scale(float x, float y);
+            void rotate(float angle);
+            void shutdown();
+        }
+
+        namespace atlas {
+            void init();
+            ALLEGRO_BITMAP *add(ALLEGRO_BITMAP *bitmap, const std::string group);
+            bool release(ALLEGRO_BITMAP *bitmap);
+            int64_t bytes();
+            void shutdown();
+        }
+
     }
 
     // File IO ----------------------------------------------------------------
     namespace io {
 
         namespace file {
-            ALLEGRO_FILE *open(const std::string filename, void **rbuf);
-            bool close(ALLEGRO_FILE *fp, void **rbuf);
+            bool map(const std::string filename, FileBuffer *buf);
+            bool read(const std::string filename, FileBuffer *buf);
+            void release(FileBuffer *buf);
+            bool stat(const std::string filename, int64_t *size, int64_t *mtime);
+            ALLEGRO_FILE *open(const std::string filename, FileBuffer *buf);
+            bool close(ALLEGRO_FILE *fp, FileBuffer *buf);
+        }
+
+        namespace archive {
+            bool open(const std::string filename);
+            bool find(const std::string filename, FileBuffer *buf);
+            int64_t modified();
+            void close();
+        }
+
+        namespace cache {
+            ALLEGRO_BITMAP *load(const std::string filename);
+            void store(const std::string filename, ALLEGRO_BITMAP *bitmap);
+        }
+
+        namespace loader {
+            void init();
+            void queue(LOAD_TYPE type, const std::string filename, LoadCallback callback, void *data);
+            unsigned int pending();
+            unsigned int failed();
+            float progress();
+            void update();
+            void shutdown();
         }
 
         namespace image {
@@ -225,6 +486,12 @@ namespace Game {
             ALLEGRO_SAMPLE *open(const std::string filename);
         }
 
+        namespace resample {
+            void init();
+            ALLEGRO_SAMPLE *convert(ALLEGRO_SAMPLE *sample, unsigned int frequency);
+            void shutdown();
+        }
+
         namespace stream {
             ALLEGRO_AUDIO_STREAM *open(const std::string filename);
         }
@@ -21,6 +21,50 @@
 
 namespace Game { namespace api { namespace game {
 
+    // Preloading -------------------------------------------------------------
+    CallbackList *preloads;
+
+    v8::Handle<v8::Value> parseManifest(const std::string filename) {
+
+        v8::HandleScope scope;
+
+        FileBuffer buf;
+        ALLEGRO_FILE *fp = io::file::open(filename, &buf);
+        if (fp == NULL) {
+            return v8::Undefined();
+        }
+
+        v8::Handle<v8::Value> source = v8::String::New(static_cast<const char*>(buf.data), buf.size);
+        io::file::close(fp, &buf);
+
+        v8::Handle<v8::Object> json = js.global->Get(v8::String::NewSymbol("JSON"))->ToObject();
+        v8::Handle<v8::Function> parse = v8::Handle<v8::Function>::Cast(json->Get(v8::String::NewSymbol("parse")));
+
+        v8::TryCatch tryCatch;
+        v8::Handle<v8::Value> manifest = parse->Call(json, 1, &source);
+        if (manifest.IsEmpty()) {
+            debugArgs("api::game", "Invalid manifest '%s'", filename.data());
+            handleException(tryCatch);
+            return v8::Undefined();
+        }
+
+        return scope.Close(manifest);
+
+    }
+
+    void queueList(const v8::Handle<v8::Object> &manifest, const char *key, void (*preload)(const std::string)) {
+
+        v8::Handle<v8::Value> list = manifest->Get(v8::String::NewSymbol(key));
+        if (list->IsArray()) {
+            v8::Handle<v8::Array> files = v8::Handle<v8::Array>::Cast(list);
+            for(unsigned int i = 0; i < files->Length(); i++) {
+                preload(ToString(files->Get(i)));
+            }
+        }
+
+    }
+
+
     // API --------------------------------------------------------------------
     v8::Handle<v8::Value> getTime(const v8::Arguments& args) {
         return v8::Number::New(time.time);
@@ -30,6 +74,10 @@ namespace Game { namespace api { namespace game {
         return v8::Number::New(time.delta);
     }
 
+    v8::Handle<v8::Value> getAlpha(const v8::Arguments& args) {
+        return v8::Number::New(time.alpha);
+    }
+
     v8::Handle<v8::Value> resume(const v8::Arguments& args) {
         if (state.paused) {
             state.paused = false;
@@ -78,16 +126,103 @@ namespace Game { namespace api { namespace game {
         }
     }
 
+    v8::Handle<v8::Value> preload(const v8::Arguments& args) {
+
+        if (args.Length() < 1) {
+            return v8::False();
+        }
+
+        // Either a manifest object or the name of a JSON file with one
+        v8::Handle<v8::Value> manifest = args[0];
+        if (manifest->IsString()) {
+            manifest = parseManifest(ToString(manifest));
+        }
+
+        if (!manifest->IsObject()) {
+            return v8::False();
+        }
+
+        // All files go into the loader queue at once, so they are read and
+        // decoded by all workers in parallel
+        v8::Handle<v8::Object> object = manifest->ToObject();
+        queueList(object, "images", image::preload);
+        queueList(object, "sounds", sound::preload);
+        queueList(object, "music", music::preload);
+
+        if (args.Length() > 1 && args[1]->IsFunction()) {
+            v8::Handle<v8::Function> callback = v8::Handle<v8::Function>::Cast(args[1]);
+            preloads->push_back(v8::Persistent<v8::Function>::New(callback));
+        }
+
+        return v8::True();
+
+    }
+
+    v8::Handle<v8::Value> getProgress(const v8::Arguments& args) {
+        return v8::Number::New(io::loader::progress());
+    }
+
+    v8::Handle<v8::Value> getMemory(const v8::Arguments& args) {
+
+        v8::HandleScope scope;
+        v8::Handle<v8::Object> info = v8::Object::New();
+        setNumberProp(info, "images", memory.images.bytes);
+        setNumberProp(info, "sounds", memory.sounds.bytes);
+        setNumberProp(info, "music", memory.music.bytes);
+        setNumberProp(info, "atlas", render::atlas::bytes());
+
+        return scope.Close(info);
+
+    }
+
+
     // Export -----------------------------------------------------------------
     void init(const v8::Handle<v8::Object> &object) {
 
+        preloads = new CallbackList();
+
         setFunctionProp(object, "getTime", getTime);
         setFunctionProp(object, "getDelta", getDelta);
+        setFunctionProp(object, "getAlpha", getAlpha);
         setFunctionProp(object, "pause", pause);
         setFunctionProp(object, "resume", resume);
         setFunctionProp(object, "isPaused", isPaused);
         setFunctionProp(object, "reload", reload); 
         setFunctionProp(object, "quit", quit); 
+        setFunctionProp(object, "preload", preload); 
+        setFunctionProp(object, "getProgress", getProgress); 
+        setFunctionProp(object, "getMemory", getMemory); 
+
+    }
+
+    void update() {
+
+        if (preloads->empty() || io::loader::pending() > 0) {
+            return;
+        }
+
+        v8::HandleScope scope;
+        v8::Handle<v8::Value> args[1];
+        args[0] = v8::Boolean::New(io::loader::failed() == 0);
+
+        CallbackList callbacks;
+        callbacks.swap(*preloads);
+
+        for(CallbackList::iterator it = callbacks.begin(); it != callbacks.end(); it++) {
+            call(*it, args, 1);
+            it->Dispose();
+        }
+
+    }
+
+    void shutdown() {
+
+        for(CallbackList::iterator it = preloads->begin(); it != preloads->end(); it++) {
+            it->Dispose();
+        }
+
+        preloads->clear();
+        delete preloads;
 
     }
 
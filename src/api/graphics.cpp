@@ -21,6 +21,14 @@
 
 namespace Game { namespace api { namespace graphics {
 
+    // Shape types for graphics.shapes()
+    typedef enum SHAPE_TYPE {
+        SHAPE_LINE = 0,
+        SHAPE_RECT = 1,
+        SHAPE_FILLED_RECT = 2
+
+    } SHAPE_TYPE;
+
     #define getNumber(obj, key)
 
     #define colorMap(colorValue) \
@@ -65,6 +73,11 @@ namespace Game { namespace api { namespace graphics {
 
     // API --------------------------------------------------------------------
     v8::Handle<v8::Value> setRenderOffset(const v8::Arguments& args) {
+        if (args.Length() >= 2) {
+            Game::graphics.offsetX = ToInt32(args[0]);
+            Game::graphics.offsetY = ToInt32(args[1]);
+            render::transform::apply();
+        }
         return v8::Undefined();
     }
     v8::Handle<v8::Value> getRenderOffset(const v8::Arguments& args) {
@@ -74,6 +87,61 @@ namespace Game { namespace api { namespace graphics {
         return pos;
     }
 
+    v8::Handle<v8::Value> getViewRect(const v8::Arguments& args) {
+        v8::Handle<v8::Object> rect = v8::Object::New();
+        setNumberProp(rect, "x", Game::graphics.viewX);
+        setNumberProp(rect, "y", Game::graphics.viewY);
+        setNumberProp(rect, "w", Game::graphics.viewWidth);
+        setNumberProp(rect, "h", Game::graphics.viewHeight);
+        return rect;
+    }
+
+
+    v8::Handle<v8::Value> getStats(const v8::Arguments& args) {
+        v8::Handle<v8::Object> obj = v8::Object::New();
+        setNumberProp(obj, "draws", Game::stats.draws);
+        setNumberProp(obj, "culled", Game::stats.culled);
+        setNumberProp(obj, "batches", Game::stats.batches);
+        return obj;
+    }
+
+
+    // Transformations --------------------------------------------------------
+    // ------------------------------------------------------------------------
+    v8::Handle<v8::Value> push(const v8::Arguments& args) {
+        render::transform::push();
+        return v8::Undefined();
+    }
+
+    v8::Handle<v8::Value> pop(const v8::Arguments& args) {
+        return v8::Boolean::New(render::transform::pop());
+    }
+
+    v8::Handle<v8::Value> translate(const v8::Arguments& args) {
+        if (args.Length() >= 2) {
+            render::transform::translate(ToFloat(args[0]), ToFloat(args[1]));
+        }
+        return v8::Undefined();
+    }
+
+    v8::Handle<v8::Value> scale(const v8::Arguments& args) {
+        if (args.Length() >= 1) {
+            float x = ToFloat(args[0]);
+            render::transform::scale(x, args.Length() >= 2 ? ToFloat(args[1]) : x);
+        }
+        return v8::Undefined();
+    }
+
+    v8::Handle<v8::Value> rotate(const v8::Arguments& args) {
+        if (args.Length() >= 1) {
+            render::transform::rotate(ToFloat(args[0]));
+        }
+        return v8::Undefined();
+    }
+
+
+    // Display ----------------------------------------------------------------
+    // ------------------------------------------------------------------------
     v8::Handle<v8::Value> setScale(const v8::Arguments& args) {
         if (args.Length() >= 1) {
             int scale = ToInt32(args[0]);
@@ -150,22 +218,39 @@ namespace Game { namespace api { namespace graphics {
         return v8::Number::New(Game::graphics.lineWidth);
     }
 
-    v8::Handle<v8::Value> line(const v8::Arguments& args) {
+    void drawLine(float x1, float y1, float x2, float y2) {
 
-        if (args.Length() >= 4) {
+        if (Game::graphics.lineWidth % 2 == 1) {
+            x1 += 0.5;
+            x2 += 0.5;
+        } 
+
+        render::prim::line(x1, y1, x2, y2, Game::graphics.color, Game::graphics.lineWidth);
+
+    }
 
-            double x1 = ToFloat(args[0]) + Game::graphics.offsetX;
-            double y1 = ToFloat(args[1]) + Game::graphics.offsetY;
-            double x2 = ToFloat(args[2]) + Game::graphics.offsetX;
-            double y2 = ToFloat(args[3]) + Game::graphics.offsetY;
+    void drawRect(float x, float y, float w, float h, bool filled) {
+
+        if (filled) {
+            render::prim::filledRect(x, y, x + w, y + h, Game::graphics.color);
+
+        } else {
 
             if (Game::graphics.lineWidth % 2 == 1) {
-                x1 += 0.5;
-                x2 += 0.5;
+                x += 0.5;
+                y += 0.5;
             } 
 
-            al_draw_line(x1, y1, x2, y2, Game::graphics.color, Game::graphics.lineWidth);
-            
+            render::prim::rect(x, y, x + w - 1, y + h - 1, Game::graphics.color, Game::graphics.lineWidth);
+
+        }
+
+    }
+
+    v8::Handle<v8::Value> line(const v8::Arguments& args) {
+
+        if (args.Length() >= 4) {
+            drawLine(ToFloat(args[0]), ToFloat(args[1]), ToFloat(args[2]), ToFloat(args[3]));
         }
 
         return v8::Undefined();
@@ -175,29 +260,66 @@ namespace Game { namespace api { namespace graphics {
     v8::Handle<v8::Value> rect(const v8::Arguments& args) {
 
         if (args.Length() >= 4) {
+            drawRect(ToFloat(args[0]), ToFloat(args[1]), ToFloat(args[2]), ToFloat(args[3]),
+                     args.Length() >= 5 && args[4]->BooleanValue() == true);
+        }
+
+        return v8::Undefined();
 
-            double x = ToFloat(args[0]) + Game::graphics.offsetX;
-            double y = ToFloat(args[1]) + Game::graphics.offsetY;
-            double w = ToFloat(args[2]) + Game::graphics.offsetX;
-            double h = ToFloat(args[3]) + Game::graphics.offsetY;
+    }
 
-            if (args.Length() >= 5 && args[4]->BooleanValue() == true) {
-                al_draw_filled_rectangle(x, y, x + w, y + h, Game::graphics.color);
+    v8::Handle<v8::Value> shapes(const v8::Arguments& args) {
 
-            } else {
+        if (args.Length() < 1) {
+            return v8::False();
+        }
 
-                if (Game::graphics.lineWidth % 2 == 1) {
-                    x += 0.5;
-                    y += 0.5;
-                } 
+        // Shape data, either from a Float32Array or a plain array
+        int length;
+        std::vector<float> copy;
+        const float *data = static_cast<const float*>(ToExternalArray(args[0], v8::kExternalFloatArray, &length));
+        if (data == NULL) {
 
-                al_draw_rectangle(x, y, x + w - 1, y + h - 1, Game::graphics.color, Game::graphics.lineWidth);
+            if (!args[0]->IsArray()) {
+                return v8::False();
+            }
 
+            v8::Handle<v8::Array> list = v8::Handle<v8::Array>::Cast(args[0]);
+            length = list->Length();
+            copy.resize(length);
+            for(int i = 0; i < length; i++) {
+                copy[i] = ToFloat(list->Get(i));
             }
 
+            data = copy.empty() ? NULL : &copy[0];
+
         }
 
-        return v8::Undefined();
+        // Each shape is [type, x1, y1, x2, y2] for lines and [type, x, y, w, h]
+        // for rects
+        for(int i = 0; i + 5 <= length; i += 5) {
+
+            const float *s = data + i;
+            switch((int)s[0]) {
+                case SHAPE_LINE:
+                    drawLine(s[1], s[2], s[3], s[4]);
+                    break;
+
+                case SHAPE_RECT:
+                    drawRect(s[1], s[2], s[3], s[4], false);
+                    break;
+
+                case SHAPE_FILLED_RECT:
+                    drawRect(s[1], s[2], s[3], s[4], true);
+                    break;
+
+                default:
+                    break;
+            }
+
+        }
+
+        return v8::True();
 
     }
 
@@ -206,6 +328,14 @@ namespace Game { namespace api { namespace graphics {
 
         setFunctionProp(object, "setRenderOffset", setRenderOffset);
         setFunctionProp(object, "getRenderOffset", getRenderOffset);
+        setFunctionProp(object, "getViewRect", getViewRect);
+        setFunctionProp(object, "getStats", getStats);
+
+        setFunctionProp(object, "push", push);
+        setFunctionProp(object, "pop", pop);
+        setFunctionProp(object, "translate", translate);
+        setFunctionProp(object, "scale", scale);
+        setFunctionProp(object, "rotate", rotate);
 
         setFunctionProp(object, "setScale", setScale);
         setFunctionProp(object, "getScale", getScale);
@@ -227,6 +357,11 @@ namespace Game { namespace api { namespace graphics {
 
         setFunctionProp(object, "line", line);
         setFunctionProp(object, "rect", rect);
+        setFunctionProp(object, "shapes", shapes);
+
+        setNumberProp(object, "LINE", SHAPE_LINE);
+        setNumberProp(object, "RECT", SHAPE_RECT);
+        setNumberProp(object, "FILLED_RECT", SHAPE_FILLED_RECT);
 
     }
 
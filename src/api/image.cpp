@@ -18,37 +18,281 @@
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 // THE SOFTWARE.
 #include "../Game.h"
+#include <algorithm>
+#include <math.h>
 
 namespace Game { namespace api { namespace image {
 
     // Structs ----------------------------------------------------------------
     typedef struct {
         std::string filename;
+        std::string group;
         ALLEGRO_BITMAP *bitmap;
         bool loaded;
+        bool pending;
+        bool evicted;
+        int64_t bytes;
+        unsigned int lastUsed;
         int cols;
         int rows;
+        v8::Persistent<v8::Object> handle;
+        CallbackList callbacks;
 
     } Image;
 
     typedef std::map<const std::string, Image*> ImageMap;
+    typedef std::vector<Image*> ImageList;
 
 
-    // Loader -----------------------------------------------------------------
+    // Memory -----------------------------------------------------------------
     ImageMap *images;
+
+    void setBitmap(Image *img, ALLEGRO_BITMAP *bitmap) {
+
+        img->bitmap = bitmap;
+        img->loaded = bitmap != NULL;
+        img->lastUsed = Game::time.frame;
+
+        if (bitmap) {
+            img->bytes = (int64_t)al_get_bitmap_width(bitmap) * al_get_bitmap_height(bitmap) * 4;
+            memory.images.bytes += img->bytes;
+            memory.images.count++;
+        }
+
+    }
+
+    void releaseBitmap(Image *img) {
+
+        if (img->bitmap) {
+
+            // Sprites of this image might still be queued up
+            render::flush();
+            if (!render::atlas::release(img->bitmap)) {
+                al_destroy_bitmap(img->bitmap);
+            }
+
+            memory.images.bytes -= img->bytes;
+            memory.images.count--;
+
+            img->bitmap = NULL;
+            img->bytes = 0;
+
+        }
+
+    }
+
+    bool compareLastUsed(const Image *a, const Image *b) {
+        return a->lastUsed < b->lastUsed;
+    }
+
+    // Evict the least recently drawn images until we are within budget
+    // again, images drawn during the last frame are never evicted.
+    //
+    // Neither are images packed into the atlas: freeing their region does
+    // not free page memory, and reloading them would pack them again
+    void enforceBudget() {
+
+        if (memory.images.budget <= 0 || memory.images.bytes <= memory.images.budget) {
+            return;
+        }
+
+        ImageList unused;
+        for(ImageMap::iterator it = images->begin(); it != images->end(); it++) {
+            Image *img = it->second;
+            // draw() bumps the frame counter before the render callback
+            // runs, so the previous frame's images are still in use
+            if (img->bitmap && img->lastUsed + 1 < Game::time.frame
+                && al_get_parent_bitmap(img->bitmap) == NULL) {
+                unused.push_back(img);
+            }
+        }
+
+        std::sort(unused.begin(), unused.end(), compareLastUsed);
+        for(ImageList::iterator it = unused.begin(); it != unused.end(); it++) {
+
+            if (memory.images.bytes <= memory.images.budget) {
+                break;
+            }
+
+            debugArgs("api::image", "Evicted '%s', %d bytes", (*it)->filename.data(), (int)(*it)->bytes);
+            releaseBitmap(*it);
+            (*it)->evicted = true;
+
+        }
+
+    }
+
+
+    // Loader -----------------------------------------------------------------
+    Image* addImage(std::string filename, ALLEGRO_BITMAP *bitmap, const std::string group, const int cols, const int rows) {
+
+        Image *img = new Image();
+        img->filename = filename;
+        img->group = group;
+        img->pending = false;
+        img->evicted = false;
+        img->bytes = 0;
+        img->cols = cols;
+        img->rows = rows;
+        setBitmap(img, bitmap);
+        images->insert(std::make_pair(filename, img));
+
+        enforceBudget();
+        return img;
+
+    }
+
+    ALLEGRO_BITMAP *packBitmap(ALLEGRO_BITMAP *bitmap, const std::string group) {
+
+        if (bitmap && Game::graphics.atlas) {
+            ALLEGRO_BITMAP *region = render::atlas::add(bitmap, group);
+            if (region) {
+                al_destroy_bitmap(bitmap);
+                return region;
+            }
+        }
+
+        return bitmap;
+
+    }
+
     Image* getImage(std::string filename, const int cols, const int rows) {
         
         ImageMap::iterator it = images->find(filename);
         if (it == images->end()) {
-            
-            Image *img = new Image();
-            img->filename = filename;
-            img->bitmap = io::image::open(filename);
-            img->loaded = img->bitmap != NULL;
-            img->cols = cols;
-            img->rows = rows;
-            images->insert(std::make_pair(filename, img));
+            return addImage(filename, packBitmap(io::image::open(filename), ""), "", cols, rows);
+
+        } else {
+            return it->second;
+        }
+
+    }
+
+    void getTileRegion(const Image *img, const int index, int *x, int *y, int *w, int *h) {
+        *w = al_get_bitmap_width(img->bitmap) / img->cols;
+        *h = al_get_bitmap_height(img->bitmap) / img->rows;
+        *x = (index % img->cols) * (*w);
+        *y = (index / img->cols) * (*h);
+    }
+
+    Image *imageFromArg(const v8::Arguments& args) {
+
+        Image *img = static_cast<Image*>(unwrapHandle(args[0], HANDLE_IMAGE));
+        if (img == NULL) {
+            img = getImage(ToString(args[0]), 1, 1);
+        }
+
+        // Bring back evicted images on their next use
+        if (img->evicted) {
+            debugArgs("api::image", "Reloading evicted '%s'", img->filename.data());
+            img->evicted = false;
+            setBitmap(img, packBitmap(io::image::open(img->filename), img->group));
+            enforceBudget();
+        }
+
+        img->lastUsed = Game::time.frame;
+        return img;
+
+    }
+
+    // Looks up an image without loading it
+    Image *findImage(const v8::Handle<v8::Value> &value) {
+
+        Image *img = static_cast<Image*>(unwrapHandle(value, HANDLE_IMAGE));
+        if (img == NULL) {
+            ImageMap::iterator it = images->find(ToString(value));
+            if (it != images->end()) {
+                img = it->second;
+            }
+        }
+
+        return img;
+
+    }
+
+    v8::Handle<v8::Value> getHandle(Image *img) {
+
+        if (img->handle.IsEmpty()) {
+            img->handle = v8::Persistent<v8::Object>::New(wrapHandle(HANDLE_IMAGE, img, img->filename));
+        }
+
+        return img->handle;
+
+    }
+
+    typedef std::pair<ALLEGRO_BITMAP*, std::string> PendingImage;
+
+    bool isPending(const std::vector<PendingImage> &pending, const std::string filename) {
+        for(unsigned int i = 0; i < pending.size(); i++) {
+            if (pending[i].second == filename) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool compareHeight(const PendingImage &a, const PendingImage &b) {
+        return al_get_bitmap_height(a.first) > al_get_bitmap_height(b.first);
+    }
+
+
+    // Async ------------------------------------------------------------------
+    void notify(Image *img) {
+
+        v8::HandleScope scope;
+        v8::Handle<v8::Value> args[1];
+        if (img->loaded) {
+            args[0] = getHandle(img);
+
+        } else {
+            args[0] = v8::False();
+        }
+
+        // Callbacks might queue further loads for the same image
+        CallbackList callbacks;
+        callbacks.swap(img->callbacks);
+
+        for(CallbackList::iterator it = callbacks.begin(); it != callbacks.end(); it++) {
+            call(*it, args, 1);
+            it->Dispose();
+        }
+
+    }
+
+    // Workers decode into memory bitmaps which are uploaded here
+    void loaded(void *result, void *data) {
+
+        Image *img = static_cast<Image*>(data);
+        ALLEGRO_BITMAP *bitmap = static_cast<ALLEGRO_BITMAP*>(result);
+
+        if (bitmap) {
+
+            ALLEGRO_BITMAP *packed = packBitmap(bitmap, "");
+            if (packed == bitmap && !(al_get_new_bitmap_flags() & ALLEGRO_MEMORY_BITMAP)) {
+                packed = al_clone_bitmap(bitmap);
+                al_destroy_bitmap(bitmap);
+            }
+
+            bitmap = packed;
+
+        }
+
+        setBitmap(img, bitmap);
+        img->pending = false;
+        enforceBudget();
+        debugArgs("api::image", "Async load of '%s' %s", img->filename.data(), img->loaded ? "done" : "failed");
+
+        notify(img);
+
+    }
+
+    Image *queueImage(const std::string filename, const int cols, const int rows) {
 
+        ImageMap::iterator it = images->find(filename);
+        if (it == images->end()) {
+            Image *img = addImage(filename, NULL, "", cols, rows);
+            img->pending = true;
+            io::loader::queue(LOAD_IMAGE, filename, loaded, img);
             return img;
 
         } else {
@@ -70,8 +314,9 @@ namespace Game { namespace api { namespace image {
                 rows = ToInt32(args[2]);
             }
 
-            if (getImage(ToString(args[0]), rows, cols)->loaded) {   
-                return v8::True();
+            Image *img = getImage(ToString(args[0]), cols, rows);
+            if (img->loaded || img->pending) {   
+                return getHandle(img);
             }
 
         } 
@@ -80,19 +325,92 @@ namespace Game { namespace api { namespace image {
 
     }
 
+    v8::Handle<v8::Value> loadAsync(const v8::Arguments& args) {
+
+        int argc = args.Length();
+        if (argc < 2 || !args[argc - 1]->IsFunction()) {
+            return v8::False();
+        }
+
+        int rows = 1;
+        int cols = 1;
+
+        if (argc >= 4) {
+            cols = ToInt32(args[1]);
+            rows = ToInt32(args[2]);
+        }
+
+        Image *img = queueImage(ToString(args[0]), cols, rows);
+
+        v8::Handle<v8::Function> callback = v8::Handle<v8::Function>::Cast(args[argc - 1]);
+        img->callbacks.push_back(v8::Persistent<v8::Function>::New(callback));
+
+        // Already loaded (or failed), report right away
+        if (!img->pending) {
+            notify(img);
+        }
+
+        if (img->loaded || img->pending) {
+            return getHandle(img);
+        }
+
+        return v8::False();
+
+    }
+
+    v8::Handle<v8::Value> loadGroup(const v8::Arguments& args) {
+
+        if (args.Length() < 2 || !args[1]->IsArray()) {
+            return v8::False();
+        }
+
+        std::string group = ToString(args[0]);
+        v8::Handle<v8::Array> files = v8::Handle<v8::Array>::Cast(args[1]);
+
+        // Load everything first so the group can be packed tallest first
+        std::vector<PendingImage> pending;
+
+        bool loaded = true;
+        for(unsigned int i = 0; i < files->Length(); i++) {
+
+            std::string filename = ToString(files->Get(i));
+            if (images->find(filename) != images->end() || isPending(pending, filename)) {
+                continue;
+            }
+
+            ALLEGRO_BITMAP *bitmap = io::image::open(filename);
+            if (bitmap) {
+                pending.push_back(std::make_pair(bitmap, filename));
+
+            } else {
+                addImage(filename, NULL, group, 1, 1);
+                loaded = false;
+            }
+
+        }
+
+        std::sort(pending.begin(), pending.end(), compareHeight);
+        for(unsigned int i = 0; i < pending.size(); i++) {
+            addImage(pending[i].second, packBitmap(pending[i].first, group), group, 1, 1);
+        }
+
+        return v8::Boolean::New(loaded);
+
+    }
+
     v8::Handle<v8::Value> draw(const v8::Arguments& args) {
 
         if (args.Length() < 3) {
             return v8::Undefined();
         }
 
-        Image *img = getImage(ToString(args[0]), 1, 1);
+        Image *img = imageFromArg(args);
         if (img->bitmap == NULL) {
             return v8::False();
         }
 
-        int x = ToInt32(args[1]) + Game::graphics.offsetX; 
-        int y = ToInt32(args[2]) + Game::graphics.offsetY; 
+        int x = ToInt32(args[1]); 
+        int y = ToInt32(args[2]); 
 
         int flags = 0;
         if (args.Length() > 3 && args[3]->BooleanValue() == true) {
@@ -104,12 +422,8 @@ namespace Game { namespace api { namespace image {
         }
 
         double a = args.Length() > 5 ? ToFloat(args[5]) : 1;
-        if (a == 1) {
-            al_draw_bitmap(img->bitmap, x, y, flags);
-
-        } else {
-            al_draw_tinted_bitmap(img->bitmap, al_map_rgba_f(1, 1, 1, a), x, y, flags);
-        }
+        render::batch::draw(img->bitmap, 0, 0, al_get_bitmap_width(img->bitmap), al_get_bitmap_height(img->bitmap),
+                            x, y, al_map_rgba_f(1, 1, 1, a), flags);
 
         return v8::True();
 
@@ -122,7 +436,7 @@ namespace Game { namespace api { namespace image {
             int cols = ToInt32(args[1]);
             int rows = ToInt32(args[2]);
 
-            Image *img = getImage(ToString(args[0]), cols, rows);
+            Image *img = imageFromArg(args);
             img->cols = cols;
             img->rows = rows;
             
@@ -138,19 +452,17 @@ namespace Game { namespace api { namespace image {
             return v8::Undefined();
         }
 
-        Image *img = getImage(ToString(args[0]), 1, 1);
+        Image *img = imageFromArg(args);
         if (img->bitmap == NULL) {
             return v8::False();
         }
 
-        int x = ToInt32(args[1]) + Game::graphics.offsetX; 
-        int y = ToInt32(args[2]) + Game::graphics.offsetY; 
+        int x = ToInt32(args[1]); 
+        int y = ToInt32(args[2]); 
         int index = ToInt32(args[3]);
 
-        int w = al_get_bitmap_width(img->bitmap) / img->cols;
-        int h = al_get_bitmap_height(img->bitmap) / img->rows;
-        int ty = index / img->rows;
-        int tx = index - ty * img->cols;
+        int tx, ty, w, h;
+        getTileRegion(img, index, &tx, &ty, &w, &h);
 
         int flags = 0;
         if (args.Length() > 4 && args[4]->BooleanValue() == true) {
@@ -162,11 +474,89 @@ namespace Game { namespace api { namespace image {
         }
 
         double a = args.Length() > 6 ? ToFloat(args[6]) : 1;
-        if (a == 1) {
-            al_draw_bitmap_region(img->bitmap, tx * w, ty * h, w, h, x, y, flags);
+        render::batch::draw(img->bitmap, tx, ty, w, h, x, y, al_map_rgba_f(1, 1, 1, a), flags);
+
+        return v8::True();
+
+    }
+
+    v8::Handle<v8::Value> drawTileLayer(const v8::Arguments& args) {
+
+        if (args.Length() < 6) {
+            return v8::Undefined();
+        }
+
+        Image *img = imageFromArg(args);
+        if (img->bitmap == NULL) {
+            return v8::False();
+        }
+
+        int x = ToInt32(args[1]); 
+        int y = ToInt32(args[2]); 
+        int cols = ToInt32(args[3]);
+        int rows = ToInt32(args[4]);
+        if (cols <= 0 || rows <= 0) {
+            return v8::False();
+        }
+
+        // Tile indices, either from a Uint16Array or a plain array
+        int length;
+        std::vector<uint16_t> copy;
+        const uint16_t *tiles = static_cast<const uint16_t*>(ToExternalArray(args[5], v8::kExternalUnsignedShortArray, &length));
+        if (tiles == NULL) {
+
+            if (!args[5]->IsArray()) {
+                return v8::False();
+            }
+
+            v8::Handle<v8::Array> list = v8::Handle<v8::Array>::Cast(args[5]);
+            length = list->Length();
+            copy.resize(length);
+            for(int i = 0; i < length; i++) {
+                copy[i] = list->Get(i)->Uint32Value();
+            }
+
+            tiles = copy.empty() ? NULL : &copy[0];
+
+        }
+
+        rows = std::min(rows, length / cols);
+
+        int w = al_get_bitmap_width(img->bitmap) / img->cols;
+        int h = al_get_bitmap_height(img->bitmap) / img->rows;
+        int count = img->cols * img->rows;
+        if (w <= 0 || h <= 0) {
+            return v8::False();
+        }
+
+        // Only walk the part of the layer which is inside the visible rect
+        float vx = Game::graphics.viewX - x;
+        float vy = Game::graphics.viewY - y;
+        int colStart = std::max(0, (int)floorf(vx / w));
+        int colEnd = std::min(cols, (int)ceilf((vx + Game::graphics.viewWidth) / w));
+        int rowStart = std::max(0, (int)floorf(vy / h));
+        int rowEnd = std::min(rows, (int)ceilf((vy + Game::graphics.viewHeight) / h));
+
+        double a = args.Length() > 6 ? ToFloat(args[6]) : 1;
+        ALLEGRO_COLOR tint = al_map_rgba_f(1, 1, 1, a);
+
+        int tx, ty;
+        for(int row = rowStart; row < rowEnd; row++) {
+
+            const uint16_t *line = tiles + row * cols;
+            for(int col = colStart; col < colEnd; col++) {
+
+                // 0 marks an empty tile, everything else is offset by one
+                int index = line[col] - 1;
+                if (index < 0 || index >= count) {
+                    continue;
+                }
+
+                getTileRegion(img, index, &tx, &ty, &w, &h);
+                render::batch::draw(img->bitmap, tx, ty, w, h, x + col * w, y + row * h, tint, 0);
+
+            }
 
-        } else {
-            al_draw_tinted_bitmap_region(img->bitmap, al_map_rgba_f(1, 1, 1, a), tx * w, ty * h, w, h, x, y, flags);
         }
 
         return v8::True();
@@ -174,15 +564,68 @@ namespace Game { namespace api { namespace image {
     }
 
 
+    v8::Handle<v8::Value> unload(const v8::Arguments& args) {
+
+        if (args.Length() < 1) {
+            return v8::False();
+        }
+
+        // The image stays known, so handles remain valid and it gets
+        // loaded again on its next use.
+        //
+        // Atlas space is not reused, so packed images stay resident
+        Image *img = findImage(args[0]);
+        if (img && img->bitmap && al_get_parent_bitmap(img->bitmap) == NULL) {
+            debugArgs("api::image", "Unloaded '%s'", img->filename.data());
+            releaseBitmap(img);
+            img->evicted = true;
+            return v8::True();
+        }
+
+        return v8::False();
+
+    }
+
+    v8::Handle<v8::Value> getMemory(const v8::Arguments& args) {
+
+        v8::HandleScope scope;
+        v8::Handle<v8::Object> resident = v8::Object::New();
+        for(ImageMap::iterator it = images->begin(); it != images->end(); it++) {
+            if (it->second->bitmap) {
+                setNumberProp(resident, it->first.data(), it->second->bytes);
+            }
+        }
+
+        v8::Handle<v8::Object> info = v8::Object::New();
+        setNumberProp(info, "bytes", memory.images.bytes);
+        setNumberProp(info, "budget", memory.images.budget);
+        setNumberProp(info, "count", memory.images.count);
+        setNumberProp(info, "atlas", render::atlas::bytes());
+        setProp(info, "resident", resident);
+
+        return scope.Close(info);
+
+    }
+
+
     // Export -----------------------------------------------------------------
+    void preload(const std::string filename) {
+        queueImage(filename, 1, 1);
+    }
+
     void init(const v8::Handle<v8::Object> &object) {
 
         images = new ImageMap();
 
         setFunctionProp(object, "load", load);
+        setFunctionProp(object, "loadAsync", loadAsync);
+        setFunctionProp(object, "loadGroup", loadGroup);
         setFunctionProp(object, "draw", draw);
         setFunctionProp(object, "drawTiled", drawTiled);
+        setFunctionProp(object, "drawTileLayer", drawTileLayer);
         setFunctionProp(object, "setTiled", setTiled);
+        setFunctionProp(object, "unload", unload);
+        setFunctionProp(object, "getMemory", getMemory);
 
     }
 
@@ -192,6 +635,11 @@ namespace Game { namespace api { namespace image {
         for(ImageMap::iterator it = images->begin(); it != images->end(); it++) {
 
             Image *img = it->second;
+            img->handle.Dispose();
+            for(CallbackList::iterator c = img->callbacks.begin(); c != img->callbacks.end(); c++) {
+                c->Dispose();
+            }
+
             if (img->bitmap) {
                 debugArgs("api::image::bitmap", "Destroyed '%s'", img->filename.data());
                 al_destroy_bitmap(img->bitmap);
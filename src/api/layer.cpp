@@ -0,0 +1,344 @@
+// Copyright (c) 2012 Ivo Wetzel.
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+#include "../Game.h"
+#include <algorithm>
+
+// Above this many dirty rects a layer just re-renders their bounding box
+#define MAX_DIRTY_RECTS 8
+
+namespace Game { namespace api { namespace layer {
+
+    // Structs ----------------------------------------------------------------
+    typedef struct {
+        int x;
+        int y;
+        int w;
+        int h;
+
+    } Rect;
+
+    typedef std::vector<Rect> RectList;
+
+    typedef struct {
+        std::string name;
+        ALLEGRO_BITMAP *bitmap;
+        v8::Persistent<v8::Function> render;
+        RectList dirty;
+
+        // Removing a layer from within its own render callback only marks
+        // it, renderDirty() destroys it once the callback returned
+        bool rendering;
+        bool removed;
+
+    } Layer;
+
+    typedef std::map<const std::string, Layer*> LayerMap;
+
+
+    // Helper -----------------------------------------------------------------
+    LayerMap *layers;
+
+    Layer *layerFromArg(const v8::Arguments& args) {
+
+        if (args.Length() > 0) {
+            LayerMap::iterator it = layers->find(ToString(args[0]));
+            if (it != layers->end()) {
+                return it->second;
+            }
+        }
+
+        return NULL;
+
+    }
+
+    bool touches(const Rect &a, const Rect &b) {
+        return a.x <= b.x + b.w && b.x <= a.x + a.w && a.y <= b.y + b.h && b.y <= a.y + a.h;
+    }
+
+    Rect merge(const Rect &a, const Rect &b) {
+        int x = std::min(a.x, b.x);
+        int y = std::min(a.y, b.y);
+        Rect r = { x, y, std::max(a.x + a.w, b.x + b.w) - x, std::max(a.y + a.h, b.y + b.h) - y };
+        return r;
+    }
+
+    void invalidateRect(Layer *layer, Rect rect) {
+
+        // Clip to the layer
+        int w = al_get_bitmap_width(layer->bitmap);
+        int h = al_get_bitmap_height(layer->bitmap);
+        int x2 = std::min(rect.x + rect.w, w);
+        int y2 = std::min(rect.y + rect.h, h);
+        rect.x = std::max(rect.x, 0);
+        rect.y = std::max(rect.y, 0);
+        rect.w = x2 - rect.x;
+        rect.h = y2 - rect.y;
+
+        if (rect.w <= 0 || rect.h <= 0) {
+            return;
+        }
+
+        // Fold in all existing rects the new one touches
+        RectList &dirty = layer->dirty;
+        bool merged = true;
+        while(merged) {
+
+            merged = false;
+            for(RectList::iterator it = dirty.begin(); it != dirty.end(); it++) {
+                if (touches(*it, rect)) {
+                    rect = merge(*it, rect);
+                    dirty.erase(it);
+                    merged = true;
+                    break;
+                }
+            }
+
+        }
+
+        dirty.push_back(rect);
+
+        if (dirty.size() > MAX_DIRTY_RECTS) {
+            for(unsigned int i = 1; i < dirty.size(); i++) {
+                dirty[0] = merge(dirty[0], dirty[i]);
+            }
+            dirty.resize(1);
+        }
+
+    }
+
+    void destroy(Layer *layer) {
+        debugArgs("api::layer", "Destroyed '%s'", layer->name.data());
+        al_destroy_bitmap(layer->bitmap);
+        layer->render.Dispose();
+        delete layer;
+    }
+
+    // Expects the layer to be taken out of the map already
+    void release(Layer *layer) {
+
+        // Pending sprites might still reference the bitmap
+        render::flush();
+
+        if (layer->rendering) {
+            layer->removed = true;
+
+        } else {
+            destroy(layer);
+        }
+
+    }
+
+    // Returns false if the layer was removed while rendering
+    bool renderDirty(Layer *layer) {
+
+        v8::HandleScope scope;
+        v8::Handle<v8::Value> args[4];
+
+        // Whatever is still batched belongs to the current target
+        render::flush();
+
+        ALLEGRO_BITMAP *target = al_get_target_bitmap();
+        int cx, cy, cw, ch;
+        al_get_clipping_rectangle(&cx, &cy, &cw, &ch);
+
+        // Layers are drawn in their own space
+        int offsetX = Game::graphics.offsetX;
+        int offsetY = Game::graphics.offsetY;
+        Game::graphics.offsetX = 0;
+        Game::graphics.offsetY = 0;
+
+        al_set_target_bitmap(layer->bitmap);
+        unsigned int depth = render::transform::depth();
+        render::transform::push();
+
+        // The callbacks may invalidate the layer again, those rects are
+        // rendered on the next draw
+        RectList dirty;
+        dirty.swap(layer->dirty);
+        layer->rendering = true;
+
+        for(RectList::iterator it = dirty.begin(); it != dirty.end() && !layer->removed; it++) {
+
+            al_set_clipping_rectangle(it->x, it->y, it->w, it->h);
+            al_clear_to_color(al_map_rgba(0, 0, 0, 0));
+            render::transform::identity();
+
+            args[0] = v8::Number::New(it->x);
+            args[1] = v8::Number::New(it->y);
+            args[2] = v8::Number::New(it->w);
+            args[3] = v8::Number::New(it->h);
+            call(layer->render, args, 4);
+
+            render::flush();
+
+        }
+
+        layer->rendering = false;
+
+        Game::graphics.offsetX = offsetX;
+        Game::graphics.offsetY = offsetY;
+
+        al_set_target_bitmap(target);
+        al_set_clipping_rectangle(cx, cy, cw, ch);
+
+        // Scripts might leave extra transformations on the stack
+        while(render::transform::depth() > depth) {
+            render::transform::pop();
+        }
+
+        if (layer->removed) {
+            destroy(layer);
+            return false;
+        }
+
+        return true;
+
+    }
+
+
+    // API --------------------------------------------------------------------
+    v8::Handle<v8::Value> create(const v8::Arguments& args) {
+
+        if (args.Length() < 4 || !args[3]->IsFunction()) {
+            return v8::False();
+        }
+
+        std::string name = ToString(args[0]);
+        int w = ToInt32(args[1]);
+        int h = ToInt32(args[2]);
+        if (w <= 0 || h <= 0) {
+            return v8::False();
+        }
+
+        ALLEGRO_BITMAP *bitmap = al_create_bitmap(w, h);
+        if (bitmap == NULL) {
+            debugArgs("api::layer", "Failed to create '%s'", name.data());
+            return v8::False();
+        }
+
+        LayerMap::iterator it = layers->find(name);
+        if (it != layers->end()) {
+            Layer *old = it->second;
+            layers->erase(it);
+            release(old);
+        }
+
+        Layer *layer = new Layer();
+        layer->name = name;
+        layer->bitmap = bitmap;
+        layer->rendering = false;
+        layer->removed = false;
+        layer->render = v8::Persistent<v8::Function>::New(v8::Handle<v8::Function>::Cast(args[3]));
+        layers->insert(std::make_pair(name, layer));
+
+        Rect all = { 0, 0, w, h };
+        invalidateRect(layer, all);
+
+        debugArgs("api::layer", "Created '%s' (%dx%d)", name.data(), w, h);
+        return v8::True();
+
+    }
+
+    v8::Handle<v8::Value> invalidate(const v8::Arguments& args) {
+
+        Layer *layer = layerFromArg(args);
+        if (layer == NULL) {
+            return v8::False();
+        }
+
+        Rect rect = { 0, 0, al_get_bitmap_width(layer->bitmap), al_get_bitmap_height(layer->bitmap) };
+        if (args.Length() >= 5) {
+            rect.x = ToInt32(args[1]);
+            rect.y = ToInt32(args[2]);
+            rect.w = ToInt32(args[3]);
+            rect.h = ToInt32(args[4]);
+        }
+
+        invalidateRect(layer, rect);
+        return v8::True();
+
+    }
+
+    v8::Handle<v8::Value> draw(const v8::Arguments& args) {
+
+        Layer *layer = layerFromArg(args);
+        if (layer == NULL || args.Length() < 3) {
+            return v8::False();
+        }
+
+        // A layer can't be drawn into itself
+        if (layer->rendering) {
+            return v8::False();
+
+        } else if (!layer->dirty.empty() && !renderDirty(layer)) {
+            return v8::False();
+        }
+
+        int x = ToInt32(args[1]);
+        int y = ToInt32(args[2]);
+        double a = args.Length() > 3 ? ToFloat(args[3]) : 1;
+
+        render::batch::draw(layer->bitmap, 0, 0, al_get_bitmap_width(layer->bitmap), al_get_bitmap_height(layer->bitmap),
+                            x, y, al_map_rgba_f(1, 1, 1, a), 0);
+
+        return v8::True();
+
+    }
+
+    v8::Handle<v8::Value> remove(const v8::Arguments& args) {
+
+        Layer *layer = layerFromArg(args);
+        if (layer == NULL) {
+            return v8::False();
+        }
+
+        layers->erase(layer->name);
+        release(layer);
+        return v8::True();
+
+    }
+
+
+    // Export -----------------------------------------------------------------
+    void init(const v8::Handle<v8::Object> &object) {
+
+        layers = new LayerMap();
+
+        setFunctionProp(object, "create", create);
+        setFunctionProp(object, "invalidate", invalidate);
+        setFunctionProp(object, "draw", draw);
+        setFunctionProp(object, "remove", remove);
+
+    }
+
+    void shutdown() {
+
+        debugMsg("api::layer", "Shutdown...");
+        for(LayerMap::iterator it = layers->begin(); it != layers->end(); it++) {
+            destroy(it->second);
+        }
+
+        layers->clear();
+        delete layers;
+
+    }
+
+}}}
+
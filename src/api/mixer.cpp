@@ -0,0 +1,109 @@
+// Copyright (c) 2012 Ivo Wetzel.
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+#include "../Game.h"
+#include <algorithm>
+
+namespace Game { namespace api { namespace mixer {
+
+    // Helpers ----------------------------------------------------------------
+    int busFromArg(const v8::Arguments& args, int index) {
+
+        if (args.Length() > index) {
+            return mix::bus::find(ToString(args[index]));
+        }
+
+        return -1;
+
+    }
+
+
+    // API --------------------------------------------------------------------
+    v8::Handle<v8::Value> setVolume(const v8::Arguments& args) {
+
+        int bus = busFromArg(args, 0);
+        if (bus == -1 || args.Length() < 2 || !args[1]->IsNumber()) {
+            return v8::False();
+        }
+
+        float gain = ToFloat(args[1]);
+        if (gain < 0.0f || gain > 1.0f) {
+            return v8::False();
+        }
+
+        float duration = args.Length() > 2 ? std::max(ToFloat(args[2]), 0.0f) : 0.0f;
+        mix::bus::setGain(static_cast<AUDIO_BUS>(bus), gain, duration);
+        return v8::True();
+
+    }
+
+    v8::Handle<v8::Value> getVolume(const v8::Arguments& args) {
+
+        int bus = busFromArg(args, 0);
+        if (bus == -1) {
+            return v8::False();
+        }
+
+        return v8::Number::New(mix::bus::getGain(static_cast<AUDIO_BUS>(bus)));
+
+    }
+
+    v8::Handle<v8::Value> duck(const v8::Arguments& args) {
+
+        int bus = busFromArg(args, 0);
+        int by = busFromArg(args, 1);
+        if (bus == -1 || by == -1 || bus == by || args.Length() < 3) {
+            return v8::False();
+        }
+
+        float level = ToFloat(args[2]);
+        if (level < 0.0f || level > 1.0f) {
+            return v8::False();
+        }
+
+        float attack = args.Length() > 3 ? std::max(ToFloat(args[3]), 0.0f) : 0.1f;
+        float release = args.Length() > 4 ? std::max(ToFloat(args[4]), 0.0f) : 0.5f;
+        mix::bus::duck(static_cast<AUDIO_BUS>(bus), static_cast<AUDIO_BUS>(by), level, attack, release);
+        return v8::True();
+
+    }
+
+    v8::Handle<v8::Value> unduck(const v8::Arguments& args) {
+
+        int bus = busFromArg(args, 0);
+        if (bus == -1) {
+            return v8::False();
+        }
+
+        mix::bus::unduck(static_cast<AUDIO_BUS>(bus));
+        return v8::True();
+
+    }
+
+
+    // Export -----------------------------------------------------------------
+    void init(const v8::Handle<v8::Object> &object) {
+        setFunctionProp(object, "setVolume", setVolume);
+        setFunctionProp(object, "getVolume", getVolume);
+        setFunctionProp(object, "duck", duck);
+        setFunctionProp(object, "unduck", unduck);
+    }
+
+}}}
+
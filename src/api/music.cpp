@@ -19,6 +19,7 @@
 // THE SOFTWARE.
 #include "../Game.h"
 #include <algorithm>
+#include <deque>
 
 namespace Game { namespace api { namespace music {
 
@@ -35,67 +36,187 @@ namespace Game { namespace api { namespace music {
         ALLEGRO_AUDIO_STREAM *stream;
         MUSIC_STATE state;
         bool looping;
+        AUDIO_BUS bus;
         bool loaded;
-
+        bool pending;
+        int64_t bytes;
+        unsigned int lastUsed;
+        double stoppedAt;
+        double endsAt;
+        bool fadingOut;
+
+        // Gain and pan are ramped by the channel on the audio thread, these
+        // are the values last set from script
+        mix::channel::Channel *channel;
         float gain;
         float pan;
-        float speed;
 
-        float gainFrom;
-        float panFrom;
+        float speed;
         float speedFrom;
-
-        float gainTo;
-        float panTo;
         float speedTo;
-
-        float gainDuration;
-        float panDuration;
         float speedDuration;
 
+        v8::Persistent<v8::Object> handle;
+        CallbackList callbacks;
+
     } Music;
 
     typedef std::map<const std::string, Music*> MusicMap;
     typedef std::vector<Music*> MusicList;
 
+    typedef struct {
+        Music *music;
+        float fade;
+
+    } Track;
+
+    typedef std::deque<Track> TrackQueue;
+
 
     // Helper -----------------------------------------------------------------
     MusicMap *songs;
     MusicList *playing;
+    MusicList *idle;
+    double now;
 
-    Music* getMusic(std::string filename) {
-       
-        MusicMap::iterator it = songs->find(filename);
-        Music *m;
+    // Streams report their end through this queue, instead of being polled
+    ALLEGRO_EVENT_QUEUE *events;
 
-        bool created = false;
-        if (it == songs->end()) {
-            
-            m = new Music();
-            m->filename = filename;
-            m->stream = NULL;
-            m->looping = false;
-            m->loaded = false; 
-            m->state = MUSIC_STATE_STOPPED;
+    void closeStream(Music *m) {
 
-            m->gain = 1.0f;
-            m->pan = 0.0f;
-            m->speed = 1.0f;
+        if (m->stream == NULL) {
+            return;
+        }
 
-            m->gainFrom = 1.0f;
-            m->panFrom = 0.0f;
-            m->speedFrom = 1.0f;
+        idle->erase(std::remove(idle->begin(), idle->end(), m), idle->end());
 
-            m->gainTo = 1.0f;
-            m->panTo = 0.0f;
-            m->speedTo = 1.0f;
+        if (al_get_audio_stream_attached(m->stream)) {
+            debugArgs("music", "Detach %s", m->filename.data());
+            al_detach_audio_stream(m->stream);
+        }
+
+        al_destroy_audio_stream(m->stream);
+        m->stream = NULL;
+
+        memory.music.bytes -= m->bytes;
+        memory.music.count--;
+        m->bytes = 0;
+
+    }
+
+    bool compareLastUsed(const Music *a, const Music *b) {
+        return a->lastUsed < b->lastUsed;
+    }
+
+    // Close the least recently used streams which are stopped
+    void enforceBudget() {
 
-            m->gainDuration = 0.0f;
-            m->panDuration = 0.0f;
-            m->speedDuration = 0.0f;
+        if (memory.music.budget <= 0 || memory.music.bytes <= memory.music.budget) {
+            return;
+        }
+
+        MusicList unused;
+        for(MusicMap::iterator it = songs->begin(); it != songs->end(); it++) {
+            Music *m = it->second;
+            if (m->stream && m->state == MUSIC_STATE_STOPPED && m->lastUsed < Game::time.frame) {
+                unused.push_back(m);
+            }
+        }
 
-            songs->insert(std::make_pair(filename, m));
+        std::sort(unused.begin(), unused.end(), compareLastUsed);
+        for(MusicList::iterator it = unused.begin(); it != unused.end(); it++) {
 
+            if (memory.music.bytes <= memory.music.budget) {
+                break;
+            }
+
+            debugArgs("api::music", "Evicted '%s', %d bytes", (*it)->filename.data(), (int)(*it)->bytes);
+            closeStream(*it);
+
+        }
+
+    }
+
+    void setupStream(Music *m) {
+
+        m->lastUsed = Game::time.frame;
+        if (m->stream) {
+
+            // Streams only keep their fragment buffers resident
+            m->bytes = (int64_t)al_get_audio_stream_fragments(m->stream)
+                     * al_get_audio_stream_length(m->stream)
+                     * al_get_channel_count(al_get_audio_stream_channels(m->stream))
+                     * al_get_audio_depth_size(al_get_audio_stream_depth(m->stream));
+
+            memory.music.bytes += m->bytes;
+            memory.music.count++;
+
+            if (events == NULL) {
+                events = al_create_event_queue();
+            }
+
+            al_register_event_source(events, al_get_audio_stream_event_source(m->stream));
+            al_set_audio_stream_playing(m->stream, false);
+            al_set_audio_stream_playmode(m->stream, m->looping ? ALLEGRO_PLAYMODE_LOOP : ALLEGRO_PLAYMODE_ONCE);
+            al_set_audio_stream_speed(m->stream, m->speed);
+
+            if (m->channel == NULL) {
+                m->channel = mix::channel::create(m->bus, m->gain, m->pan);
+            }
+
+            m->loaded = true;
+
+        } else {
+            m->loaded = false;
+        }
+
+    }
+
+    void openStream(Music *m) {
+        m->stream = io::stream::open(m->filename);
+        setupStream(m);
+        enforceBudget();
+    }
+
+    Music* addMusic(std::string filename) {
+
+        Music *m = new Music();
+        m->filename = filename;
+        m->stream = NULL;
+        m->looping = false;
+        m->bus = BUS_MUSIC;
+        m->loaded = false; 
+        m->pending = false;
+        m->bytes = 0;
+        m->lastUsed = Game::time.frame;
+        m->stoppedAt = 0;
+        m->endsAt = 0;
+        m->fadingOut = false;
+        m->state = MUSIC_STATE_STOPPED;
+
+        m->channel = NULL;
+        m->gain = 1.0f;
+        m->pan = 0.0f;
+
+        m->speed = 1.0f;
+        m->speedFrom = 1.0f;
+        m->speedTo = 1.0f;
+        m->speedDuration = 0.0f;
+
+        songs->insert(std::make_pair(filename, m));
+
+        return m;
+
+    }
+
+    Music* getMusic(std::string filename) {
+       
+        MusicMap::iterator it = songs->find(filename);
+        Music *m;
+
+        bool created = false;
+        if (it == songs->end()) {
+            m = addMusic(filename);
             created = true;
 
         } else {
@@ -104,20 +225,7 @@ namespace Game { namespace api { namespace music {
 
         // Load audio stream
         if (!m->stream && (m->loaded || created)) {
-
-            m->stream = io::stream::open(filename);
-            if (m->stream) {
-                al_set_audio_stream_playing(m->stream, false);
-                al_set_audio_stream_playmode(m->stream, m->looping ? ALLEGRO_PLAYMODE_LOOP : ALLEGRO_PLAYMODE_ONCE);
-                al_set_audio_stream_gain(m->stream, m->gain);
-                al_set_audio_stream_pan(m->stream, m->pan);
-                al_set_audio_stream_speed(m->stream, m->speed);
-                m->loaded = true;
-
-            } else {
-                m->loaded = false;
-            }
-
+            openStream(m);
         }
 
         return m;
@@ -129,7 +237,15 @@ namespace Game { namespace api { namespace music {
         Music *m = NULL;
         if (args.Length() > 0) {
 
-            m = getMusic(ToString(args[0]));
+            m = static_cast<Music*>(unwrapHandle(args[0], HANDLE_MUSIC));
+            if (m == NULL) {
+                m = getMusic(ToString(args[0]));
+
+            } else if (!m->stream && m->loaded) {
+                openStream(m);
+            }
+
+            m->lastUsed = Game::time.frame;
             if (!m->loaded) {
                 m = NULL;
             }
@@ -140,13 +256,87 @@ namespace Game { namespace api { namespace music {
 
     }
 
+    v8::Handle<v8::Value> getHandle(Music *m) {
+
+        if (m->handle.IsEmpty()) {
+            m->handle = v8::Persistent<v8::Object>::New(wrapHandle(HANDLE_MUSIC, m, m->filename));
+        }
+
+        return m->handle;
+
+    }
+
+    // Async ------------------------------------------------------------------
+    void notify(Music *m) {
+
+        v8::HandleScope scope;
+        v8::Handle<v8::Value> args[1];
+        if (m->loaded) {
+            args[0] = getHandle(m);
+
+        } else {
+            args[0] = v8::False();
+        }
+
+        CallbackList callbacks;
+        callbacks.swap(m->callbacks);
+
+        for(CallbackList::iterator it = callbacks.begin(); it != callbacks.end(); it++) {
+            call(*it, args, 1);
+            it->Dispose();
+        }
+
+    }
+
+    void loaded(void *result, void *data) {
+
+        Music *m = static_cast<Music*>(data);
+        ALLEGRO_AUDIO_STREAM *stream = static_cast<ALLEGRO_AUDIO_STREAM*>(result);
+        m->pending = false;
+
+        // Opened synchronously in the meantime
+        if (m->stream) {
+            if (stream) {
+                al_destroy_audio_stream(stream);
+            }
+
+            notify(m);
+            return;
+
+        }
+
+        m->stream = stream;
+        setupStream(m);
+        enforceBudget();
+        debugArgs("api::music", "Async load of '%s' %s", m->filename.data(), m->loaded ? "done" : "failed");
+
+        notify(m);
+
+    }
+
+    Music *queueMusic(const std::string filename) {
+
+        MusicMap::iterator it = songs->find(filename);
+        if (it == songs->end()) {
+            Music *m = addMusic(filename);
+            m->pending = true;
+            io::loader::queue(LOAD_STREAM, filename, loaded, m);
+            return m;
+
+        } else {
+            return it->second;
+        }
+
+    }
+
     void playStream(Music *m) {
 
         debugArgs("music", "Play %s", m->filename.data());
+        idle->erase(std::remove(idle->begin(), idle->end(), m), idle->end());
 
         if (m->stream && !al_get_audio_stream_attached(m->stream)) {
             debugArgs("music", "Attach %s", m->filename.data());
-            al_attach_audio_stream_to_mixer(m->stream, al_get_default_mixer());
+            al_attach_audio_stream_to_mixer(m->stream, mix::channel::mixer(m->channel));
         }
 
         playing->push_back(m);
@@ -160,15 +350,118 @@ namespace Game { namespace api { namespace music {
 
         playing->erase(std::remove(playing->begin(), playing->end(), m), playing->end());
         al_set_audio_stream_playing(m->stream, false);
-        al_rewind_audio_stream(m->stream);
 
-        if (m->stream && al_get_audio_stream_attached(m->stream)) {
-            debugArgs("music", "Detach %s", m->filename.data());
-            al_detach_audio_stream(m->stream);
+        // Rewinding only seeks the decoder, fragments which are already
+        // queued up would play first. Once the stream has ended there are
+        // none left, so it stays open and a replay starts instantly
+        if (m->endsAt > 0 && now >= m->endsAt) {
+            al_rewind_audio_stream(m->stream);
+            idle->push_back(m);
+
+        } else {
+            closeStream(m);
         }
 
-        al_destroy_audio_stream(m->stream);
-        m->stream = NULL;
+        m->stoppedAt = now;
+        m->endsAt = 0;
+
+        // Undo a fade out, so the next play has its old volume
+        if (m->fadingOut) {
+            m->fadingOut = false;
+            mix::channel::set(m->channel, CHANNEL_GAIN, m->gain, 0.0f, RAMP_LINEAR);
+        }
+
+    }
+
+
+    // Playlist ---------------------------------------------------------------
+    TrackQueue *tracks;
+    Music *current;
+    bool waiting;
+
+    // Open the stream in the background well before it is needed
+    void prepare(Music *m) {
+
+        if (!m->stream && !m->pending) {
+            debugArgs("api::music", "Preparing '%s'", m->filename.data());
+            m->pending = true;
+            io::loader::queue(LOAD_STREAM, m->filename, loaded, m);
+        }
+
+    }
+
+    void advance(float duration) {
+
+        // Fade out or cut the current track
+        if (current && current->state != MUSIC_STATE_STOPPED) {
+
+            if (duration > 0 && current->state == MUSIC_STATE_PLAYING) {
+                current->fadingOut = true;
+                mix::channel::set(current->channel, CHANNEL_GAIN, 0.0f, duration, RAMP_LINEAR);
+
+            } else {
+                stopStream(current);
+                current->state = MUSIC_STATE_STOPPED;
+            }
+
+        }
+
+        current = NULL;
+        waiting = false;
+
+        // Skip over tracks which failed to load
+        while(current == NULL && !tracks->empty()) {
+
+            Music *m = tracks->front().music;
+
+            // Keep it at the front, update() starts it once it has loaded
+            if (!m->stream && m->pending) {
+                debugArgs("api::music", "Waiting for '%s'", m->filename.data());
+                waiting = true;
+                break;
+            }
+
+            tracks->pop_front();
+
+            // Still not ready, this is the hitch we wanted to avoid
+            if (!m->stream && m->loaded) {
+                debugArgs("api::music", "'%s' was not ready in time", m->filename.data());
+                openStream(m);
+            }
+
+            if (m->stream && m->state == MUSIC_STATE_STOPPED) {
+                current = m;
+            }
+
+        }
+
+        if (current) {
+
+            if (duration > 0) {
+                mix::channel::ramp(current->channel, CHANNEL_GAIN, 0.0f, current->gain, duration, RAMP_LINEAR);
+            }
+
+            current->state = MUSIC_STATE_PLAYING;
+            playStream(current);
+
+            if (!tracks->empty()) {
+                prepare(tracks->front().music);
+            }
+
+        }
+
+    }
+
+    // Seconds until the stream runs out, or -1 if it never does
+    double remaining(Music *m) {
+
+        if (m->looping || m->speed <= 0) {
+            return -1;
+        }
+
+        double length = al_get_audio_stream_length_secs(m->stream);
+        double position = al_get_audio_stream_position_secs(m->stream);
+        return (length - position) / m->speed;
 
     }
 
@@ -208,6 +501,35 @@ namespace Game { namespace api { namespace music {
 
     }
 
+    // Fire and forget, the channel ramps the value while mixing
+    v8::Handle<v8::Value> setChannel(const v8::Arguments& args, Music *m, CHANNEL_PARAM param,
+                                     float *value, float minLimit, float maxLimit) {
+
+        if (m && args.Length() > 1 && args[1]->IsNumber()) {
+
+            float val = ToFloat(args[1]);
+            float duration = args.Length() > 2 && args[2]->IsNumber() ? ToFloat(args[2]) : 0.0f;
+            if (val >= minLimit && val <= maxLimit && duration >= 0) {
+
+                RAMP_CURVE curve = args.Length() > 3 ? mix::channel::curve(ToString(args[3])) : RAMP_LINEAR;
+                *value = val;
+
+                // Streams pick the value up once they are open, and a running
+                // fade out finishes first
+                if (m->channel && !(param == CHANNEL_GAIN && m->fadingOut)) {
+                    mix::channel::set(m->channel, param, val, duration, curve);
+                }
+
+                return v8::True();
+
+            }
+
+        }
+
+        return v8::False();
+
+    }
+
     void updateValue(ALLEGRO_AUDIO_STREAM *stream, float *value, 
                       const double dt, const float duration,
                       const float from, const float to,
@@ -244,7 +566,46 @@ namespace Game { namespace api { namespace music {
 
     // API --------------------------------------------------------------------
     v8::Handle<v8::Value> load(const v8::Arguments& args) {
-        return musicFromArg(args) ? v8::True() : v8::False();
+
+        if (args.Length() > 0) {
+
+            Music *m = static_cast<Music*>(unwrapHandle(args[0], HANDLE_MUSIC));
+            if (m == NULL) {
+                m = getMusic(ToString(args[0]));
+            }
+
+            // Pending music stays silent until the stream is ready
+            if (m->loaded || m->pending) {
+                return getHandle(m);
+            }
+
+        }
+
+        return v8::False();
+
+    }
+
+    v8::Handle<v8::Value> loadAsync(const v8::Arguments& args) {
+
+        if (args.Length() < 2 || !args[1]->IsFunction()) {
+            return v8::False();
+        }
+
+        Music *m = queueMusic(ToString(args[0]));
+
+        v8::Handle<v8::Function> callback = v8::Handle<v8::Function>::Cast(args[1]);
+        m->callbacks.push_back(v8::Persistent<v8::Function>::New(callback));
+
+        if (!m->pending) {
+            notify(m);
+        }
+
+        if (m->loaded || m->pending) {
+            return getHandle(m);
+        }
+
+        return v8::False();
+
     }
 
     v8::Handle<v8::Value> play(const v8::Arguments& args) {
@@ -268,19 +629,74 @@ namespace Game { namespace api { namespace music {
     }
 
     v8::Handle<v8::Value> stop(const v8::Arguments& args) {
-        musicState(!= MUSIC_STATE_STOPPED, MUSIC_STATE_STOPPED, stopStream(m));
+        musicState(!= MUSIC_STATE_STOPPED, MUSIC_STATE_STOPPED, 
+            stopStream(m);
+            if (m == current) {
+                current = NULL;
+            }
+        )
+    }
+
+    v8::Handle<v8::Value> queue(const v8::Arguments& args) {
+
+        if (args.Length() < 1) {
+            return v8::False();
+        }
+
+        Music *m = static_cast<Music*>(unwrapHandle(args[0], HANDLE_MUSIC));
+        if (m == NULL) {
+            m = queueMusic(ToString(args[0]));
+        }
+
+        Track track = { m, args.Length() > 1 ? std::max(ToFloat(args[1]), 0.0f) : 0.0f };
+        tracks->push_back(track);
+
+        if (current == NULL) {
+            advance(0);
+
+        } else if (tracks->size() == 1) {
+            prepare(m);
+        }
+
+        return v8::True();
+
+    }
+
+    v8::Handle<v8::Value> skip(const v8::Arguments& args) {
+
+        if (current == NULL && tracks->empty()) {
+            return v8::False();
+        }
+
+        float duration = args.Length() > 0 ? std::max(ToFloat(args[0]), 0.0f) : 0.0f;
+        advance(duration);
+        return v8::True();
+
+    }
+
+    v8::Handle<v8::Value> clearQueue(const v8::Arguments& args) {
+        tracks->clear();
+        return v8::Undefined();
+    }
+
+    v8::Handle<v8::Value> getCurrent(const v8::Arguments& args) {
+
+        if (current) {
+            return getHandle(current);
+        }
+
+        return v8::False();
+
     }
 
     v8::Handle<v8::Value> setVolume(const v8::Arguments& args) {
         Music *m = musicFromArg(args);
-        return setValue(args, m, &m->gain, 0.0f, 1.0f, &m->gainDuration, 
-                        &m->gainFrom, &m->gainTo, al_set_audio_stream_gain);
+        return setChannel(args, m, CHANNEL_GAIN, m ? &m->gain : NULL, 0.0f, 1.0f);
     }
 
     v8::Handle<v8::Value> setPan(const v8::Arguments& args) {
         Music *m = musicFromArg(args);
-        return setValue(args, m, &m->pan, -1.0f, 1.0f, &m->panDuration, 
-                        &m->panFrom, &m->panTo, al_set_audio_stream_pan);
+        return setChannel(args, m, CHANNEL_PAN, m ? &m->pan : NULL, -1.0f, 1.0f);
     }
 
     v8::Handle<v8::Value> setSpeed(const v8::Arguments& args) {
@@ -306,17 +722,107 @@ namespace Game { namespace api { namespace music {
         return v8::False();
     }
 
+    v8::Handle<v8::Value> setBus(const v8::Arguments& args) {
+
+        Music *m = musicFromArg(args);
+        int bus = args.Length() > 1 ? mix::bus::find(ToString(args[1])) : -1;
+        if (m && bus != -1) {
+
+            m->bus = static_cast<AUDIO_BUS>(bus);
+            if (m->channel) {
+                mix::channel::attach(m->channel, m->bus);
+            }
+
+            return v8::True();
+
+        }
+
+        return v8::False();
+
+    }
+
+    v8::Handle<v8::Value> unload(const v8::Arguments& args) {
+
+        if (args.Length() < 1) {
+            return v8::False();
+        }
+
+        Music *m = static_cast<Music*>(unwrapHandle(args[0], HANDLE_MUSIC));
+        if (m == NULL) {
+            MusicMap::iterator it = songs->find(ToString(args[0]));
+            if (it != songs->end()) {
+                m = it->second;
+            }
+        }
+
+        if (m && m->stream) {
+            debugArgs("api::music", "Unloaded '%s'", m->filename.data());
+            if (m->state != MUSIC_STATE_STOPPED) {
+                stopStream(m);
+                m->state = MUSIC_STATE_STOPPED;
+            }
+
+            if (m == current) {
+                current = NULL;
+            }
+
+            closeStream(m);
+            return v8::True();
+        }
+
+        return v8::False();
+
+    }
+
+    v8::Handle<v8::Value> getMemory(const v8::Arguments& args) {
+
+        v8::HandleScope scope;
+        v8::Handle<v8::Object> resident = v8::Object::New();
+        for(MusicMap::iterator it = songs->begin(); it != songs->end(); it++) {
+            if (it->second->stream) {
+                setNumberProp(resident, it->first.data(), it->second->bytes);
+            }
+        }
+
+        v8::Handle<v8::Object> info = v8::Object::New();
+        setNumberProp(info, "bytes", memory.music.bytes);
+        setNumberProp(info, "budget", memory.music.budget);
+        setNumberProp(info, "count", memory.music.count);
+        setProp(info, "resident", resident);
+
+        return scope.Close(info);
+
+    }
+
 
     // Export -----------------------------------------------------------------
+    void preload(const std::string filename) {
+        queueMusic(filename);
+    }
+
     void init(const v8::Handle<v8::Object> &object) {
 
         songs = new MusicMap();
         playing = new MusicList();
+        idle = new MusicList();
+        tracks = new TrackQueue();
+        current = NULL;
+        waiting = false;
+        events = NULL;
+        now = 0;
         setFunctionProp(object, "load", load);
+        setFunctionProp(object, "loadAsync", loadAsync);
         setFunctionProp(object, "play", play);
+        setFunctionProp(object, "unload", unload);
+        setFunctionProp(object, "getMemory", getMemory);
         setFunctionProp(object, "pause", pause);
         setFunctionProp(object, "resume", resume);
         setFunctionProp(object, "stop", stop);
+        setFunctionProp(object, "setBus", setBus);
+        setFunctionProp(object, "queue", queue);
+        setFunctionProp(object, "skip", skip);
+        setFunctionProp(object, "clearQueue", clearQueue);
+        setFunctionProp(object, "getCurrent", getCurrent);
         setFunctionProp(object, "setLooping", setLooping);
         setFunctionProp(object, "setVolume", setVolume);
         setFunctionProp(object, "setPan", setPan);
@@ -326,16 +832,78 @@ namespace Game { namespace api { namespace music {
 
     void update(double time, double dt) {
 
+        now = time;
+
+        // Close streams which have not been played again for a while
+        double timeout = memory.musicIdleTimeout;
+        for(MusicList::iterator it = idle->begin(); timeout > 0 && it != idle->end(); it++) {
+
+            Music *m = *it;
+            if (time - m->stoppedAt > timeout) {
+                debugArgs("api::music", "Closing idle stream '%s'", m->filename.data());
+                closeStream(m); // Invalidates the iterator, thus, we need to break out
+                break;
+            }
+
+        }
+
+        // The feeder reports the end of the file while its last fragments
+        // are still queued up for playback
+        ALLEGRO_EVENT event;
+        while(events && al_get_next_event(events, &event)) {
+
+            if (event.type != ALLEGRO_EVENT_AUDIO_STREAM_FINISHED) {
+                continue;
+            }
+
+            for(MusicList::iterator it = playing->begin(); it != playing->end(); it++) {
+
+                Music *m = *it;
+                if (m->stream && event.any.source == al_get_audio_stream_event_source(m->stream)) {
+                    double latency = (double)al_get_audio_stream_fragments(m->stream) * al_get_audio_stream_length(m->stream)
+                                   / al_get_audio_stream_frequency(m->stream);
+
+                    m->endsAt = time + latency / std::max(m->speed, 0.01f);
+                    break;
+                }
+
+            }
+
+        }
+
+        // The next track finished loading while nothing was playing
+        if (current == NULL && waiting && !tracks->empty() && !tracks->front().music->pending) {
+            advance(0);
+        }
+
+        // Start the next queued track so its fade in ends with this one
+        if (current && current->state == MUSIC_STATE_PLAYING && !tracks->empty() && tracks->front().fade > 0) {
+            double left = remaining(current);
+            if (left >= 0 && left <= tracks->front().fade) {
+                advance(tracks->front().fade);
+            }
+        }
+
+        MusicList ended;
         for(MusicList::iterator it = playing->begin(); it != playing->end(); it++) {
 
             Music *m = *it;
-            if (m->stream && !al_get_audio_stream_playing(m->stream)) {
+            if ((m->endsAt > 0 && time >= m->endsAt) || (m->fadingOut && mix::channel::get(m->channel, CHANNEL_GAIN) <= 0.0f)) {
+                ended.push_back(m);
+            }
 
-                debugArgs("api::music", "Stream '%s' ended", m->filename.data());
-                stopStream(m); // Invalidates the iterator, thus, we need to break out
-                m->state = MUSIC_STATE_STOPPED;
-                break;
+        }
+
+        for(MusicList::iterator it = ended.begin(); it != ended.end(); it++) {
+
+            Music *m = *it;
+            debugArgs("api::music", "Stream '%s' ended", m->filename.data());
+            stopStream(m);
+            m->state = MUSIC_STATE_STOPPED;
 
+            // Join the next track right away
+            if (m == current) {
+                advance(0);
             }
 
         }
@@ -344,8 +912,6 @@ namespace Game { namespace api { namespace music {
 
             Music *m = *it;
             if (m->stream && m->state == MUSIC_STATE_PLAYING) {
-                updateValue(m->stream, &m->gain, dt, m->gainDuration, m->gainFrom, m->gainTo, al_set_audio_stream_gain);
-                updateValue(m->stream, &m->pan, dt, m->panDuration, m->panFrom, m->panTo, al_set_audio_stream_pan);
                 updateValue(m->stream, &m->speed, dt, m->speedDuration, m->speedFrom, m->speedTo, al_set_audio_stream_speed);
             }
 
@@ -360,9 +926,19 @@ namespace Game { namespace api { namespace music {
         for(MusicMap::iterator it = songs->begin(); it != songs->end(); it++) {
 
             Music *song = it->second;
+            song->handle.Dispose();
+            for(CallbackList::iterator c = song->callbacks.begin(); c != song->callbacks.end(); c++) {
+                c->Dispose();
+            }
+
             if (song->stream) {
                 debugArgs("api::music::stream", "Destroyed '%s'", song->filename.data());
                 stopStream(song);
+                closeStream(song);
+            }
+
+            if (song->channel) {
+                mix::channel::destroy(song->channel);
             }
 
             debugArgs("api::music", "Destroyed '%s'", song->filename.data());
@@ -376,6 +952,16 @@ namespace Game { namespace api { namespace music {
         playing->clear();
         delete playing;
 
+        idle->clear();
+        delete idle;
+
+        tracks->clear();
+        delete tracks;
+
+        if (events) {
+            al_destroy_event_queue(events);
+        }
+
     }
 
 }}}
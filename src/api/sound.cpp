@@ -18,6 +18,22 @@
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 // THE SOFTWARE.
 #include "../Game.h"
+#include <algorithm>
+#include <queue>
+#include <math.h>
+
+// Voice ids combine the pool index with the voice's generation, so ids of
+// stolen or finished voices stop matching; config.maxVoices is at most this.
+// Ids start at 1, so a valid id is never falsy in JavaScript
+#define VOICE_ID_STRIDE 256
+
+// Emitter ids work the same way, for at most this many emitters; their
+// generation wraps around before the ids reach 2^24, so they stay exact in
+// a Float32Array
+#define EMITTER_ID_STRIDE 4096
+
+// Emitters quieter than this are culled and don't take a voice
+#define EMITTER_AUDIBLE 0.001f
 
 namespace Game { namespace api { namespace sound {
 
@@ -26,27 +42,183 @@ namespace Game { namespace api { namespace sound {
         std::string filename;
         ALLEGRO_SAMPLE *sample;
         bool loaded;
+        bool pending;
+        bool evicted;
+        int64_t bytes;
+        unsigned int lastUsed;
+        int priority;
+        int maxVoices;
+        int voices;
+        AUDIO_BUS bus;
+        v8::Persistent<v8::Object> handle;
+        CallbackList callbacks;
 
     } Sound;
 
     typedef std::map<const std::string, Sound*> SoundMap;
+    typedef std::vector<Sound*> SoundList;
 
+    typedef struct {
+        ALLEGRO_SAMPLE_INSTANCE *instance;
+        Sound *sound;
+        mix::channel::Channel *channel;
+        int priority;
+        float gain;
+        double startedAt;
+        unsigned int generation;
+        int next;
 
-    // Loader -----------------------------------------------------------------
+    } Voice;
+
+    typedef struct {
+        double endsAt;
+        int voice;
+        unsigned int generation;
+
+    } VoiceEnd;
+
+    struct VoiceEndLater {
+        bool operator()(const VoiceEnd &a, const VoiceEnd &b) const {
+            return a.endsAt > b.endsAt;
+        }
+    };
+
+    typedef std::priority_queue<VoiceEnd, std::vector<VoiceEnd>, VoiceEndLater> VoiceEndQueue;
+
+
+    // Memory -----------------------------------------------------------------
     SoundMap *sounds;
+
+    // Fixed pool of sample instances, free ones are chained through next
+    Voice *voices;
+    int voiceCount;
+    int freeVoice;
+
+    // Ordered by the time the voices run out, so update() only looks at
+    // voices which are actually due
+    VoiceEndQueue *voiceEnds;
+    double now;
+
+    void setSample(Sound *sound, ALLEGRO_SAMPLE *sample) {
+
+        sound->sample = sample;
+        sound->loaded = sample != NULL;
+        sound->lastUsed = Game::time.frame;
+
+        if (sample) {
+            sound->bytes = (int64_t)al_get_sample_length(sample)
+                         * al_get_channel_count(al_get_sample_channels(sample))
+                         * al_get_audio_depth_size(al_get_sample_depth(sample));
+
+            memory.sounds.bytes += sound->bytes;
+            memory.sounds.count++;
+        }
+
+    }
+
+    bool isPlaying(const Sound *sound) {
+        return sound->voices > 0;
+    }
+
+    void freeVoiceAt(int index) {
+
+        Voice *voice = &voices[index];
+        al_set_sample_instance_playing(voice->instance, false);
+        mix::channel::detach(voice->channel);
+        voice->sound->voices--;
+        voice->sound = NULL;
+        voice->generation++;
+        voice->next = freeVoice;
+        freeVoice = index;
+
+    }
+
+    void releaseSample(Sound *sound) {
+
+        if (sound->sample) {
+
+            // Instances must not keep pointing at the sample
+            for(int i = 0; i < voiceCount; i++) {
+                if (voices[i].sound == sound) {
+                    freeVoiceAt(i);
+                }
+                if (al_get_sample(voices[i].instance) == sound->sample) {
+                    al_set_sample(voices[i].instance, NULL);
+                }
+            }
+
+            al_destroy_sample(sound->sample);
+            memory.sounds.bytes -= sound->bytes;
+            memory.sounds.count--;
+
+            sound->sample = NULL;
+            sound->bytes = 0;
+
+        }
+
+    }
+
+    bool compareLastUsed(const Sound *a, const Sound *b) {
+        return a->lastUsed < b->lastUsed;
+    }
+
+    // Evict the least recently played sounds which are not playing right now
+    void enforceBudget() {
+
+        if (memory.sounds.budget <= 0 || memory.sounds.bytes <= memory.sounds.budget) {
+            return;
+        }
+
+        SoundList unused;
+        for(SoundMap::iterator it = sounds->begin(); it != sounds->end(); it++) {
+            Sound *sound = it->second;
+            if (sound->sample && sound->lastUsed < Game::time.frame && !isPlaying(sound)) {
+                unused.push_back(sound);
+            }
+        }
+
+        std::sort(unused.begin(), unused.end(), compareLastUsed);
+        for(SoundList::iterator it = unused.begin(); it != unused.end(); it++) {
+
+            if (memory.sounds.bytes <= memory.sounds.budget) {
+                break;
+            }
+
+            debugArgs("api::sound", "Evicted '%s', %d bytes", (*it)->filename.data(), (int)(*it)->bytes);
+            releaseSample(*it);
+            (*it)->evicted = true;
+
+        }
+
+    }
+
+
+    // Loader -----------------------------------------------------------------
+    Sound* addSound(std::string filename, ALLEGRO_SAMPLE *sample) {
+
+        Sound *sound = new Sound();
+        sound->filename = filename;
+        sound->pending = false;
+        sound->evicted = false;
+        sound->bytes = 0;
+        sound->priority = 0;
+        sound->maxVoices = 0;
+        sound->voices = 0;
+        sound->bus = BUS_SFX;
+        setSample(sound, sample);
+        sounds->insert(std::make_pair(filename, sound));
+
+        enforceBudget();
+        return sound;
+
+    }
+
     Sound* getSound(std::string filename) {
         
         // Check if we need to load the sound
         SoundMap::iterator it = sounds->find(filename);
         if (it == sounds->end()) {
-            
-            Sound *sound = new Sound();
-            sound->filename = filename;
-            sound->sample = io::sample::open(filename);
-            sound->loaded = sound->sample != NULL;
-            sounds->insert(std::make_pair(filename, sound));
-
-            return sound;
+            return addSound(filename, io::sample::open(filename));
 
         } else {
             return it->second;
@@ -54,12 +226,30 @@ namespace Game { namespace api { namespace sound {
 
     }
 
+    // Bring back evicted sounds on their next use
+    void reload(Sound *s) {
+
+        if (s->evicted) {
+            debugArgs("api::sound", "Reloading evicted '%s'", s->filename.data());
+            s->evicted = false;
+            setSample(s, io::sample::open(s->filename));
+            enforceBudget();
+        }
+
+    }
+
     Sound *soundFromArg(const v8::Arguments& args) {
 
         Sound *s = NULL;
         if (args.Length() > 0) {
 
-            s = getSound(ToString(args[0]));
+            s = static_cast<Sound*>(unwrapHandle(args[0], HANDLE_SOUND));
+            if (s == NULL) {
+                s = getSound(ToString(args[0]));
+            }
+
+            reload(s);
+            s->lastUsed = Game::time.frame;
             if (!s->loaded) {
                 s = NULL;
             }
@@ -70,46 +260,465 @@ namespace Game { namespace api { namespace sound {
 
     }
 
+    v8::Handle<v8::Value> getHandle(Sound *sound) {
 
-    // Sample Instances -------------------------------------------------------
-    typedef std::vector<ALLEGRO_SAMPLE_INSTANCE*> SampleList;
-    SampleList *instances;
+        if (sound->handle.IsEmpty()) {
+            sound->handle = v8::Persistent<v8::Object>::New(wrapHandle(HANDLE_SOUND, sound, sound->filename));
+        }
 
-    ALLEGRO_SAMPLE_INSTANCE *getInstanceForSample(Sound *sound) {
+        return sound->handle;
 
-        // Find a available sample instance
-        ALLEGRO_SAMPLE_INSTANCE *sampleInstance = NULL;
-        for(SampleList::iterator it = instances->begin(); it != instances->end(); it++) {
+    }
 
-            ALLEGRO_SAMPLE_INSTANCE *instance = *it;
 
-            // If the instance is not attached it's available
-            if (!al_get_sample_instance_attached(instance)) {
+    // Async ------------------------------------------------------------------
+    void notify(Sound *sound) {
 
-                debugArgs("api::sound", "Re-use sample instance for '%s'", sound->filename.data());
-                sampleInstance = instance;
-                al_set_sample(sampleInstance, sound->sample);
-                al_set_sample_instance_gain(sampleInstance, 1.0f);
-                al_set_sample_instance_pan(instance, 0.0f);
-                al_set_sample_instance_speed(instance, 1.0f);
-                al_attach_sample_instance_to_mixer(instance, al_get_default_mixer());
-                break;
+        v8::HandleScope scope;
+        v8::Handle<v8::Value> args[1];
+        if (sound->loaded) {
+            args[0] = getHandle(sound);
+
+        } else {
+            args[0] = v8::False();
+        }
+
+        CallbackList callbacks;
+        callbacks.swap(sound->callbacks);
+
+        for(CallbackList::iterator it = callbacks.begin(); it != callbacks.end(); it++) {
+            call(*it, args, 1);
+            it->Dispose();
+        }
+
+    }
+
+    void loaded(void *result, void *data) {
+
+        Sound *sound = static_cast<Sound*>(data);
+        setSample(sound, static_cast<ALLEGRO_SAMPLE*>(result));
+        sound->pending = false;
+        enforceBudget();
+        debugArgs("api::sound", "Async load of '%s' %s", sound->filename.data(), sound->loaded ? "done" : "failed");
+
+        notify(sound);
+
+    }
+
+    Sound *queueSound(const std::string filename) {
+
+        SoundMap::iterator it = sounds->find(filename);
+        if (it == sounds->end()) {
+            Sound *sound = addSound(filename, NULL);
+            sound->pending = true;
+            io::loader::queue(LOAD_SAMPLE, filename, loaded, sound);
+            return sound;
+
+        } else {
+            return it->second;
+        }
+
+    }
+
+
+    // Voices -----------------------------------------------------------------
+    void createVoices() {
+
+        debugArgs("api::sound", "Creating %d voices", audio.maxVoices);
+
+        voiceCount = audio.maxVoices;
+        voices = new Voice[voiceCount];
+        for(int i = 0; i < voiceCount; i++) {
+            voices[i].instance = al_create_sample_instance(NULL);
+            voices[i].channel = mix::channel::create(BUS_SFX, 1.0f, 0.0f);
+            mix::channel::detach(voices[i].channel);
+            voices[i].sound = NULL;
+            voices[i].generation = 0;
+            voices[i].next = i + 1 < voiceCount ? i + 1 : -1;
+        }
+
+        freeVoice = 0;
 
+    }
+
+    // Whether voice a should be given up before voice b
+    bool stealBefore(const Voice *a, const Voice *b) {
+
+        if (audio.stealing == VOICE_STEAL_QUIETEST && a->gain != b->gain) {
+            return a->gain < b->gain;
+        }
+
+        return a->startedAt < b->startedAt;
+
+    }
+
+    // Pick a playing voice to make room for the sound, or -1 if every
+    // candidate has a higher priority
+    int stealVoice(Sound *sound) {
+
+        // Over its own limit, the sound replaces one of its own voices
+        bool own = sound->maxVoices > 0 && sound->voices >= sound->maxVoices;
+
+        int victim = -1;
+        for(int i = 0; i < voiceCount; i++) {
+
+            Voice *voice = &voices[i];
+            if (voice->sound == NULL) {
+                continue;
+
+            } else if (own ? voice->sound != sound : voice->priority > sound->priority) {
+                continue;
+            }
+
+            if (victim == -1) {
+                victim = i;
+
+            } else {
+                Voice *v = &voices[victim];
+                if (own || voice->priority == v->priority ? stealBefore(voice, v) : voice->priority < v->priority) {
+                    victim = i;
+                }
             }
 
         }
 
-        // Create a new one if we're under the limit and no other is free
-        if (sampleInstance == NULL) {
+        return victim;
 
-            debugArgs("api::sound", "Create sample instance for '%s'", sound->filename.data());
-            sampleInstance = al_create_sample_instance(sound->sample);
-            al_attach_sample_instance_to_mixer(sampleInstance, al_get_default_mixer());
-            instances->push_back(sampleInstance);
+    }
+
+    // Sets up the voice at index to play the sound from its start
+    Voice *useVoice(int index, Sound *sound) {
+
+        Voice *voice = &voices[index];
+        voice->sound = sound;
+        voice->priority = sound->priority;
+        voice->gain = 1.0f;
+        voice->startedAt = now;
+        sound->voices++;
+
+        // Setting the sample detaches the instance
+        ALLEGRO_SAMPLE_INSTANCE *instance = voice->instance;
+        if (al_get_sample(instance) != sound->sample) {
+            al_set_sample(instance, sound->sample);
+        }
+
+        // Gain and pan are left to the channel
+        if (!al_get_sample_instance_attached(instance)) {
+            al_attach_sample_instance_to_mixer(instance, mix::channel::mixer(voice->channel));
+            al_set_sample_instance_pan(instance, ALLEGRO_AUDIO_PAN_NONE);
+        }
+
+        mix::channel::attach(voice->channel, sound->bus);
+        mix::channel::set(voice->channel, CHANNEL_GAIN, 1.0f, 0.0f, RAMP_LINEAR);
+        mix::channel::set(voice->channel, CHANNEL_PAN, 0.0f, 0.0f, RAMP_LINEAR);
+
+        al_set_sample_instance_position(instance, 0);
+        al_set_sample_instance_speed(instance, 1.0f);
+        al_set_sample_instance_playmode(instance, ALLEGRO_PLAYMODE_ONCE);
+
+        return voice;
+
+    }
+
+    Voice *getVoice(Sound *sound) {
+
+        if (voices == NULL) {
+            createVoices();
+        }
+
+        int index = -1;
+        if (freeVoice != -1 && (sound->maxVoices <= 0 || sound->voices < sound->maxVoices)) {
+            index = freeVoice;
+            freeVoice = voices[index].next;
+
+        } else {
+
+            index = stealVoice(sound);
+            if (index == -1) {
+                debugArgs("api::sound", "No voice for '%s'", sound->filename.data());
+                return NULL;
+            }
+
+            debugArgs("api::sound", "Stealing voice of '%s' for '%s'",
+                      voices[index].sound->filename.data(), sound->filename.data());
+
+            freeVoiceAt(index);
+            freeVoice = voices[index].next;
+
+        }
+
+        return useVoice(index, sound);
+
+    }
+
+    // Seconds until the instance reaches the end of its sample
+    double remaining(ALLEGRO_SAMPLE_INSTANCE *instance) {
+        double frames = (double)al_get_sample_instance_length(instance) - al_get_sample_instance_position(instance);
+        return frames / al_get_sample_instance_frequency(instance) / al_get_sample_instance_speed(instance);
+    }
+
+    void scheduleEnd(int index, double endsAt) {
+        VoiceEnd end = { endsAt, index, voices[index].generation };
+        voiceEnds->push(end);
+    }
+
+    double getVoiceId(const Voice *voice) {
+        return (double)voice->generation * VOICE_ID_STRIDE + (voice - voices) + 1;
+    }
+
+    Voice *voiceFromArg(const v8::Arguments& args) {
+
+        if (args.Length() < 1 || !args[0]->IsNumber() || voices == NULL) {
+            return NULL;
+        }
+
+        double id = args[0]->NumberValue() - 1;
+        int index = (int)fmod(id, VOICE_ID_STRIDE);
+        if (id < 0 || index >= voiceCount) {
+            return NULL;
+        }
+
+        Voice *voice = &voices[index];
+        if (voice->sound == NULL || voice->generation != (unsigned int)(id / VOICE_ID_STRIDE)) {
+            return NULL;
+        }
+
+        return voice;
+
+    }
+
+
+    // Emitters ---------------------------------------------------------------
+    typedef struct {
+        Sound *sound;
+        bool active;
+        bool loop;
+        float x;
+        float y;
+        float volume;
+        float minDistance;
+        float maxDistance;
+        double startedAt;
+        double duration;
+        unsigned int generation;
+
+        // Computed every update
+        float gain;
+        float pan;
+
+        // Pool index and generation of the voice, -1 while virtual
+        int voice;
+        unsigned int voiceGeneration;
+
+    } Emitter;
+
+    typedef std::vector<Emitter> EmitterList;
+    typedef std::vector<int> EmitterIndexList;
+
+    EmitterList *emitters;
+    EmitterIndexList *freeEmitters;
+    float listenerX;
+    float listenerY;
+    int audibleEmitters;
+
+    double getEmitterId(int index) {
+        return (double)(*emitters)[index].generation * EMITTER_ID_STRIDE + index + 1;
+    }
+
+    Emitter *emitterFromId(double id) {
+
+        id -= 1;
+        int index = (int)fmod(id, EMITTER_ID_STRIDE);
+        if (id < 0 || index >= (int)emitters->size()) {
+            return NULL;
+        }
+
+        Emitter *e = &(*emitters)[index];
+        if (!e->active || e->generation != (unsigned int)(id / EMITTER_ID_STRIDE)) {
+            return NULL;
+        }
+
+        return e;
+
+    }
+
+    bool hasVoice(const Emitter *e) {
+        return e->voice != -1 && voices[e->voice].generation == e->voiceGeneration
+                              && voices[e->voice].sound == e->sound;
+    }
+
+    void releaseEmitter(int index) {
+
+        Emitter *e = &(*emitters)[index];
+        if (hasVoice(e)) {
+            freeVoiceAt(e->voice);
+        }
+
+        e->active = false;
+        e->sound = NULL;
+        e->voice = -1;
+        e->generation = (e->generation + 1) % (EMITTER_ID_STRIDE - 1);
+        freeEmitters->push_back(index);
+
+    }
+
+    // Inverse distance inside the range, fading out towards its far end
+    void placeEmitter(Emitter *e) {
+
+        float dx = e->x - listenerX;
+        float dy = e->y - listenerY;
+        float distance = sqrtf(dx * dx + dy * dy);
+
+        if (distance >= e->maxDistance) {
+            e->gain = 0.0f;
+            e->pan = 0.0f;
+
+        } else if (distance <= e->minDistance) {
+            e->gain = e->volume;
+            e->pan = dx / std::max(e->minDistance, 1.0f);
+
+        } else {
+            float falloff = (e->maxDistance - distance) / (e->maxDistance - e->minDistance);
+            e->gain = e->volume * e->minDistance / distance * falloff;
+            e->pan = dx / distance;
+        }
+
+        e->pan = std::max(std::min(e->pan, 1.0f), -1.0f);
+
+    }
+
+    // A free voice, or the quietest one which is no more important and
+    // quieter than the emitter, so loud emitters don't fight over voices
+    int emitterVoice(const Emitter *e) {
+
+        if (voices == NULL) {
+            createVoices();
+        }
+
+        Sound *sound = e->sound;
+        bool own = sound->maxVoices > 0 && sound->voices >= sound->maxVoices;
+        if (freeVoice != -1 && !own) {
+            int index = freeVoice;
+            freeVoice = voices[index].next;
+            return index;
+        }
+
+        int victim = -1;
+        for(int i = 0; i < voiceCount; i++) {
+
+            Voice *voice = &voices[i];
+            if (voice->sound == NULL || voice->gain >= e->gain) {
+                continue;
+
+            } else if (own ? voice->sound != sound : voice->priority > sound->priority) {
+                continue;
+
+            } else if (victim == -1 || voice->gain < voices[victim].gain) {
+                victim = i;
+            }
+
+        }
+
+        if (victim != -1) {
+            freeVoiceAt(victim);
+            freeVoice = voices[victim].next;
+        }
+
+        return victim;
+
+    }
+
+    bool compareLouder(const Emitter *a, const Emitter *b) {
+        return a->gain > b->gain;
+    }
+
+    void updateEmitters(double time, double dt) {
+
+        std::vector<Emitter*> waiting;
+        audibleEmitters = 0;
+
+        for(int i = 0; i < (int)emitters->size(); i++) {
+
+            Emitter *e = &(*emitters)[i];
+            if (!e->active) {
+                continue;
+            }
+
+            // One shots keep their time while virtual and end on schedule,
+            // even if their sound was evicted or unloaded in the meantime
+            if (!e->loop && time - e->startedAt >= e->duration) {
+                releaseEmitter(i);
+                continue;
+            }
+
+            placeEmitter(e);
+
+            bool audible = e->gain > EMITTER_AUDIBLE;
+            if (audible) {
+                audibleEmitters++;
+            }
+
+            if (!hasVoice(e)) {
+                e->voice = -1;
+                if (audible) {
+                    waiting.push_back(e);
+                }
+
+            // Culled, the emitter goes on without a voice
+            } else if (!audible) {
+                freeVoiceAt(e->voice);
+                e->voice = -1;
+
+            // Ramped over the frame, to move smoothly between updates
+            } else {
+                Voice *voice = &voices[e->voice];
+                voice->gain = e->gain;
+                mix::channel::set(voice->channel, CHANNEL_GAIN, e->gain, dt, RAMP_LINEAR);
+                mix::channel::set(voice->channel, CHANNEL_PAN, e->pan, dt, RAMP_LINEAR);
+            }
+
+        }
+
+        // Loudest first, until the pool runs out
+        std::sort(waiting.begin(), waiting.end(), compareLouder);
+        for(std::vector<Emitter*>::iterator it = waiting.begin(); it != waiting.end(); it++) {
+
+            Emitter *e = *it;
+            reload(e->sound);
+            if (!e->sound->loaded) {
+                continue;
+            }
+
+            int index = emitterVoice(e);
+            if (index == -1) {
+                break;
+            }
+
+            Voice *voice = useVoice(index, e->sound);
+            ALLEGRO_SAMPLE_INSTANCE *instance = voice->instance;
+            voice->gain = e->gain;
+            mix::channel::set(voice->channel, CHANNEL_GAIN, e->gain, 0.0f, RAMP_LINEAR);
+            mix::channel::set(voice->channel, CHANNEL_PAN, e->pan, 0.0f, RAMP_LINEAR);
+
+            // Pick up where the emitter would be by now
+            unsigned int length = al_get_sample_instance_length(instance);
+            double offset = (time - e->startedAt) * al_get_sample_instance_frequency(instance);
+            if (e->loop) {
+                offset = fmod(offset, (double)length);
+                al_set_sample_instance_playmode(instance, ALLEGRO_PLAYMODE_LOOP);
+            }
+
+            al_set_sample_instance_position(instance, std::min((unsigned int)offset, length));
+            al_set_sample_instance_playing(instance, true);
+
+            if (!e->loop) {
+                scheduleEnd(index, time + remaining(instance));
+            }
+
+            e->voice = index;
+            e->voiceGeneration = voice->generation;
 
         }
-        
-        return sampleInstance;
 
     }
 
@@ -117,10 +726,42 @@ namespace Game { namespace api { namespace sound {
     // API --------------------------------------------------------------------
     v8::Handle<v8::Value> load(const v8::Arguments& args) {
 
-        Sound *sound = soundFromArg(args);
-        if (sound) {
-            return v8::True();
-        } 
+        if (args.Length() > 0) {
+
+            Sound *sound = static_cast<Sound*>(unwrapHandle(args[0], HANDLE_SOUND));
+            if (sound == NULL) {
+                sound = getSound(ToString(args[0]));
+            }
+
+            // Pending sounds are silent until they are ready
+            if (sound->loaded || sound->pending) {
+                return getHandle(sound);
+            }
+
+        }
+
+        return v8::False();
+
+    }
+
+    v8::Handle<v8::Value> loadAsync(const v8::Arguments& args) {
+
+        if (args.Length() < 2 || !args[1]->IsFunction()) {
+            return v8::False();
+        }
+
+        Sound *sound = queueSound(ToString(args[0]));
+
+        v8::Handle<v8::Function> callback = v8::Handle<v8::Function>::Cast(args[1]);
+        sound->callbacks.push_back(v8::Persistent<v8::Function>::New(callback));
+
+        if (!sound->pending) {
+            notify(sound);
+        }
+
+        if (sound->loaded || sound->pending) {
+            return getHandle(sound);
+        }
 
         return v8::False();
 
@@ -131,35 +772,38 @@ namespace Game { namespace api { namespace sound {
         Sound *sound = soundFromArg(args);
         if (sound && sound->loaded) {
 
-            ALLEGRO_SAMPLE_INSTANCE *instance = getInstanceForSample(sound);
-            if (instance) {
+            Voice *voice = getVoice(sound);
+            if (voice) {
 
+                ALLEGRO_SAMPLE_INSTANCE *instance = voice->instance;
                 debugArgs("api::sound", "Play sound '%s'", sound->filename.data()); // TODO log name, volume, pan, speed
                 
                 if (args.Length() > 1 && args[1]->IsNumber()) {
                     float gain = ToFloat(args[1]);
                     if (gain >= 0.0f && gain <= 1.0f) {
-                        al_set_sample_instance_gain(instance, gain);
+                        mix::channel::set(voice->channel, CHANNEL_GAIN, gain, 0.0f, RAMP_LINEAR);
+                        voice->gain = gain;
                     }
                 }
 
                 if (args.Length() > 2 && args[2]->IsNumber()) {
                     float pan = ToFloat(args[2]);
                     if (pan >= -1.0f && pan <= 1.0f) {
-                        al_set_sample_instance_pan(instance, pan);
+                        mix::channel::set(voice->channel, CHANNEL_PAN, pan, 0.0f, RAMP_LINEAR);
                     }
                 }
                 
                 if (args.Length() > 3 && args[3]->IsNumber()) {
                     float speed = ToFloat(args[3]);
                     if (speed > 0.0f && speed <= 1.0f) {
-                        al_set_sample_instance_gain(instance, speed);
+                        al_set_sample_instance_speed(instance, speed);
                     }
                 }
 
                 al_set_sample_instance_playing(instance, true);
+                scheduleEnd(voice - voices, now + remaining(instance));
                 
-                return v8::True();
+                return v8::Number::New(getVoiceId(voice));
 
             } else {
                 return v8::False();
@@ -171,32 +815,334 @@ namespace Game { namespace api { namespace sound {
 
     }
 
+    v8::Handle<v8::Value> setVolume(const v8::Arguments& args) {
+
+        Voice *voice = voiceFromArg(args);
+        if (voice && args.Length() > 1 && args[1]->IsNumber()) {
+
+            float gain = ToFloat(args[1]);
+            float duration = args.Length() > 2 && args[2]->IsNumber() ? ToFloat(args[2]) : 0.0f;
+            if (gain >= 0.0f && gain <= 1.0f && duration >= 0.0f) {
+                RAMP_CURVE curve = args.Length() > 3 ? mix::channel::curve(ToString(args[3])) : RAMP_LINEAR;
+                mix::channel::set(voice->channel, CHANNEL_GAIN, gain, duration, curve);
+                voice->gain = gain;
+                return v8::True();
+            }
+
+        }
+
+        return v8::False();
+
+    }
+
+    v8::Handle<v8::Value> setPan(const v8::Arguments& args) {
+
+        Voice *voice = voiceFromArg(args);
+        if (voice && args.Length() > 1 && args[1]->IsNumber()) {
+
+            float pan = ToFloat(args[1]);
+            float duration = args.Length() > 2 && args[2]->IsNumber() ? ToFloat(args[2]) : 0.0f;
+            if (pan >= -1.0f && pan <= 1.0f && duration >= 0.0f) {
+                mix::channel::set(voice->channel, CHANNEL_PAN, pan, duration, RAMP_LINEAR);
+                return v8::True();
+            }
+
+        }
+
+        return v8::False();
+
+    }
+
+    v8::Handle<v8::Value> stop(const v8::Arguments& args) {
+
+        Voice *voice = voiceFromArg(args);
+        if (voice) {
+            freeVoiceAt(voice - voices);
+            return v8::True();
+        }
+
+        return v8::False();
+
+    }
+
+    v8::Handle<v8::Value> setListener(const v8::Arguments& args) {
+
+        if (args.Length() < 2) {
+            return v8::False();
+        }
+
+        listenerX = ToFloat(args[0]);
+        listenerY = ToFloat(args[1]);
+        return v8::True();
+
+    }
+
+    v8::Handle<v8::Value> addEmitter(const v8::Arguments& args) {
+
+        Sound *sound = soundFromArg(args);
+        if (sound == NULL || args.Length() < 3) {
+            return v8::False();
+        }
+
+        int index;
+        if (freeEmitters->empty()) {
+
+            if (emitters->size() >= EMITTER_ID_STRIDE) {
+                return v8::False();
+            }
+
+            Emitter e;
+            e.generation = 0;
+            emitters->push_back(e);
+            index = emitters->size() - 1;
+
+        } else {
+            index = freeEmitters->back();
+            freeEmitters->pop_back();
+        }
+
+        Emitter *e = &(*emitters)[index];
+        e->sound = sound;
+        e->active = true;
+        e->x = ToFloat(args[1]);
+        e->y = ToFloat(args[2]);
+        e->loop = args.Length() > 3 && ToBoolean(args[3]);
+        e->volume = args.Length() > 4 ? std::max(std::min(ToFloat(args[4]), 1.0f), 0.0f) : 1.0f;
+        e->minDistance = args.Length() > 5 ? std::max(ToFloat(args[5]), 0.0f) : 32.0f;
+        e->maxDistance = args.Length() > 6 ? std::max(ToFloat(args[6]), e->minDistance + 1.0f) : 512.0f;
+        e->startedAt = now;
+        e->duration = (double)al_get_sample_length(sound->sample) / al_get_sample_frequency(sound->sample);
+        e->gain = 0.0f;
+        e->pan = 0.0f;
+        e->voice = -1;
+        e->voiceGeneration = 0;
+
+        return v8::Number::New(getEmitterId(index));
+
+    }
+
+    // Takes [id, x, y, ...] as a Float32Array or a plain array
+    v8::Handle<v8::Value> moveEmitters(const v8::Arguments& args) {
+
+        if (args.Length() < 1) {
+            return v8::False();
+        }
+
+        int length;
+        std::vector<float> copy;
+        const float *data = static_cast<const float*>(ToExternalArray(args[0], v8::kExternalFloatArray, &length));
+        if (data == NULL) {
+
+            if (!args[0]->IsArray()) {
+                return v8::False();
+            }
+
+            v8::Handle<v8::Array> list = v8::Handle<v8::Array>::Cast(args[0]);
+            length = list->Length();
+            copy.resize(length);
+            for(int i = 0; i < length; i++) {
+                copy[i] = ToFloat(list->Get(i));
+            }
+
+            data = copy.empty() ? NULL : &copy[0];
+
+        }
+
+        int moved = 0;
+        for(int i = 0; i + 3 <= length; i += 3) {
+
+            Emitter *e = emitterFromId(data[i]);
+            if (e) {
+                e->x = data[i + 1];
+                e->y = data[i + 2];
+                moved++;
+            }
+
+        }
+
+        return v8::Number::New(moved);
+
+    }
+
+    v8::Handle<v8::Value> removeEmitter(const v8::Arguments& args) {
+
+        Emitter *e = args.Length() > 0 && args[0]->IsNumber() ? emitterFromId(args[0]->NumberValue()) : NULL;
+        if (e) {
+            releaseEmitter(e - &(*emitters)[0]);
+            return v8::True();
+        }
+
+        return v8::False();
+
+    }
+
+    v8::Handle<v8::Value> getEmitters(const v8::Arguments& args) {
+
+        v8::HandleScope scope;
+        v8::Handle<v8::Object> info = v8::Object::New();
+        setNumberProp(info, "count", emitters->size() - freeEmitters->size());
+        setNumberProp(info, "audible", audibleEmitters);
+
+        int playing = 0;
+        for(EmitterList::iterator it = emitters->begin(); it != emitters->end(); it++) {
+            if (it->active && hasVoice(&*it)) {
+                playing++;
+            }
+        }
+
+        setNumberProp(info, "playing", playing);
+        return scope.Close(info);
+
+    }
+
+    v8::Handle<v8::Value> setPriority(const v8::Arguments& args) {
+
+        Sound *sound = soundFromArg(args);
+        if (sound && args.Length() > 1 && args[1]->IsNumber()) {
+            sound->priority = ToInt32(args[1]);
+            return v8::True();
+        }
+
+        return v8::False();
+
+    }
+
+    v8::Handle<v8::Value> setMaxVoices(const v8::Arguments& args) {
+
+        Sound *sound = soundFromArg(args);
+        if (sound && args.Length() > 1 && args[1]->IsNumber()) {
+            sound->maxVoices = std::max(ToInt32(args[1]), 0);
+            return v8::True();
+        }
+
+        return v8::False();
+
+    }
+
+    v8::Handle<v8::Value> setBus(const v8::Arguments& args) {
+
+        Sound *sound = soundFromArg(args);
+        int bus = args.Length() > 1 ? mix::bus::find(ToString(args[1])) : -1;
+        if (sound && bus != -1) {
+            sound->bus = static_cast<AUDIO_BUS>(bus);
+            return v8::True();
+        }
+
+        return v8::False();
+
+    }
+
+    v8::Handle<v8::Value> unload(const v8::Arguments& args) {
+
+        if (args.Length() < 1) {
+            return v8::False();
+        }
+
+        Sound *sound = static_cast<Sound*>(unwrapHandle(args[0], HANDLE_SOUND));
+        if (sound == NULL) {
+            SoundMap::iterator it = sounds->find(ToString(args[0]));
+            if (it != sounds->end()) {
+                sound = it->second;
+            }
+        }
+
+        // Stops all instances still playing it
+        if (sound && sound->sample) {
+            debugArgs("api::sound", "Unloaded '%s'", sound->filename.data());
+            releaseSample(sound);
+            sound->evicted = true;
+            return v8::True();
+        }
+
+        return v8::False();
+
+    }
+
+    v8::Handle<v8::Value> getMemory(const v8::Arguments& args) {
+
+        v8::HandleScope scope;
+        v8::Handle<v8::Object> resident = v8::Object::New();
+        for(SoundMap::iterator it = sounds->begin(); it != sounds->end(); it++) {
+            if (it->second->sample) {
+                setNumberProp(resident, it->first.data(), it->second->bytes);
+            }
+        }
+
+        v8::Handle<v8::Object> info = v8::Object::New();
+        setNumberProp(info, "bytes", memory.sounds.bytes);
+        setNumberProp(info, "budget", memory.sounds.budget);
+        setNumberProp(info, "count", memory.sounds.count);
+        setProp(info, "resident", resident);
+
+        return scope.Close(info);
+
+    }
+
 
     // Export -----------------------------------------------------------------
+    void preload(const std::string filename) {
+        queueSound(filename);
+    }
+
     void init(const v8::Handle<v8::Object> &object) {
 
         sounds = new SoundMap();
 
-        instances = new SampleList();
+        // The pool is created on first use, once the config has been read
+        voices = NULL;
+        voiceCount = 0;
+        freeVoice = -1;
+        voiceEnds = new VoiceEndQueue();
+        now = 0;
+
+        emitters = new EmitterList();
+        freeEmitters = new EmitterIndexList();
+        listenerX = 0;
+        listenerY = 0;
+        audibleEmitters = 0;
+
         setFunctionProp(object, "load", load);
+        setFunctionProp(object, "loadAsync", loadAsync);
         setFunctionProp(object, "play", play);
+        setFunctionProp(object, "setVolume", setVolume);
+        setFunctionProp(object, "setPan", setPan);
+        setFunctionProp(object, "stop", stop);
+        setFunctionProp(object, "setListener", setListener);
+        setFunctionProp(object, "addEmitter", addEmitter);
+        setFunctionProp(object, "moveEmitters", moveEmitters);
+        setFunctionProp(object, "removeEmitter", removeEmitter);
+        setFunctionProp(object, "getEmitters", getEmitters);
+        setFunctionProp(object, "setPriority", setPriority);
+        setFunctionProp(object, "setMaxVoices", setMaxVoices);
+        setFunctionProp(object, "setBus", setBus);
+        setFunctionProp(object, "unload", unload);
+        setFunctionProp(object, "getMemory", getMemory);
 
     }
 
     void update(double time, double dt) {
-        
-        for(SampleList::iterator it = instances->begin(); it != instances->end(); it++) {
 
-            ALLEGRO_SAMPLE_INSTANCE *instance = *it;
+        now = time;
+        updateEmitters(time, dt);
 
-            // Check for the instance having finished playing and detach it
-            // this marks it as avaialble
-            if (al_get_sample_instance_attached(instance)) {
-                if (!al_get_sample_instance_playing(instance)) {
-                    debugArgs("api::sound", "Done sample instance for '%s'", "unkown");
-                    //printf("[api::sound] Sample instance finished playing\n");
-                    al_detach_sample_instance(instance);
-                }
+        while(!voiceEnds->empty() && voiceEnds->top().endsAt <= time) {
+
+            VoiceEnd end = voiceEnds->top();
+            voiceEnds->pop();
+
+            // Skip voices which were stolen or released in the meantime
+            Voice *voice = &voices[end.voice];
+            if (voice->sound == NULL || voice->generation != end.generation) {
+                continue;
+            }
+
+            // The mixer may lag behind our clock by a few fragments
+            if (al_get_sample_instance_playing(voice->instance)) {
+                scheduleEnd(end.voice, time + std::max(remaining(voice->instance), dt));
+
+            } else {
+                debugArgs("api::sound", "Done voice for '%s'", voice->sound->filename.data());
+                freeVoiceAt(end.voice);
             }
 
         }
@@ -207,15 +1153,25 @@ namespace Game { namespace api { namespace sound {
 
         debugMsg("api::sound", "Shutdown...");
 
-        for(SampleList::iterator it = instances->begin(); it != instances->end(); it++) {
+        for(int i = 0; i < voiceCount; i++) {
             debugMsg("api::sound", "Destroyed sample instance");
-            al_destroy_sample_instance(*it);
+            al_destroy_sample_instance(voices[i].instance);
+            mix::channel::destroy(voices[i].channel);
         }
-        instances->clear();
-        delete instances;
+        delete[] voices;
+        delete voiceEnds;
+
+        emitters->clear();
+        delete emitters;
+        delete freeEmitters;
 
         for(SoundMap::iterator it = sounds->begin(); it != sounds->end(); it++) {
             Sound *snd = it->second;
+            snd->handle.Dispose();
+            for(CallbackList::iterator c = snd->callbacks.begin(); c != snd->callbacks.end(); c++) {
+                c->Dispose();
+            }
+
             if (snd->sample) {
                 debugArgs("api::sound::sample", "Destroyed '%s'", snd->filename.data());
                 al_destroy_sample(snd->sample);
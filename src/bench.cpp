@@ -0,0 +1,175 @@
+// Copyright (c) 2012 Ivo Wetzel.
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+#include "Game.h"
+#include <algorithm>
+
+// Benchmark Namespace --------------------------------------------------------
+namespace Game { namespace bench {
+
+    // Samples ----------------------------------------------------------------
+    typedef std::vector<double> SampleList;
+
+    static const char *names[BENCH_PHASES] = {
+        "events", "update", "render", "flip", "frame"
+    };
+
+    SampleList samples[BENCH_PHASES];
+    double started[BENCH_PHASES];
+    double current[BENCH_PHASES];
+
+    double draws = 0;
+    double culled = 0;
+    double batches = 0;
+
+    // A frame spans all loop iterations up to the next draw
+    bool framing = false;
+
+    // Reset requested while a frame was still open
+    bool resetting = false;
+
+    double percentile(const SampleList &sorted, double p) {
+        unsigned int index = (unsigned int)(p * (sorted.size() - 1) + 0.5);
+        return sorted[index];
+    }
+
+
+    // Methods ----------------------------------------------------------------
+    void begin(BENCH_PHASE phase) {
+
+        if (options.benchmark <= 0 || (phase == BENCH_FRAME && framing)) {
+            return;
+        }
+
+        started[phase] = al_get_time();
+        framing = framing || phase == BENCH_FRAME;
+
+    }
+
+    void end(BENCH_PHASE phase) {
+        if (options.benchmark > 0) {
+            current[phase] += al_get_time() - started[phase];
+        }
+    }
+
+    void clear() {
+
+        for(int i = 0; i < BENCH_PHASES; i++) {
+            samples[i].clear();
+            started[i] = 0;
+            current[i] = 0;
+        }
+
+        draws = 0;
+        culled = 0;
+        batches = 0;
+        framing = false;
+        resetting = false;
+
+    }
+
+    void frame() {
+
+        if (options.benchmark <= 0) {
+            return;
+        }
+
+        // Drop the frame which spanned the reset, its phases were already
+        // open before the reset
+        if (resetting) {
+            clear();
+            return;
+        }
+
+        for(int i = 0; i < BENCH_PHASES; i++) {
+            samples[i].push_back(current[i]);
+            current[i] = 0;
+        }
+
+        draws += stats.draws;
+        culled += stats.culled;
+        batches += stats.batches;
+        framing = false;
+
+    }
+
+    // Phases of an open frame still need their start times, so clearing
+    // waits until the frame ends
+    void reset() {
+
+        if (framing) {
+            resetting = true;
+
+        } else {
+            clear();
+        }
+
+    }
+
+    void report() {
+
+        if (options.benchmark <= 0 || samples[BENCH_FRAME].empty()) {
+            return;
+        }
+
+        FILE *fp = stdout;
+        if (options.report.length()) {
+            fp = fopen(options.report.data(), "w");
+            if (fp == NULL) {
+                debugArgs("bench", "Failed to open '%s'", options.report.data());
+                fp = stdout;
+            }
+        }
+
+        unsigned int count = samples[BENCH_FRAME].size();
+        fprintf(fp, "{\"frames\": %u, \"phases\": {", count);
+
+        // All times in milliseconds
+        for(int i = 0; i < BENCH_PHASES; i++) {
+
+            SampleList sorted = samples[i];
+            std::sort(sorted.begin(), sorted.end());
+
+            double sum = 0;
+            for(unsigned int s = 0; s < sorted.size(); s++) {
+                sum += sorted[s];
+            }
+
+            fprintf(fp, "%s\"%s\": {\"min\": %.4f, \"mean\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f}",
+                    i > 0 ? ", " : "", names[i],
+                    sorted.front() * 1000, sum / count * 1000,
+                    percentile(sorted, 0.5) * 1000, percentile(sorted, 0.95) * 1000,
+                    percentile(sorted, 0.99) * 1000, sorted.back() * 1000);
+
+        }
+
+        fprintf(fp, "}, \"stats\": {\"draws\": %.2f, \"culled\": %.2f, \"batches\": %.2f}}\n",
+                draws / count, culled / count, batches / count);
+
+        if (fp != stdout) {
+            fclose(fp);
+            debugArgs("bench", "Report written to '%s'", options.report.data());
+        }
+
+        clear();
+
+    }
+
+}}
+
@@ -0,0 +1,165 @@
+// Copyright (c) 2012 Ivo Wetzel.
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+#include "../Game.h"
+#include "archive.h"
+#include <string.h>
+
+namespace Game { namespace io { namespace archive {
+
+    FileBuffer pak = { NULL, 0, FILE_BUFFER_HEAP };
+    const ArchiveEntry *entries = NULL;
+    uint32_t count = 0;
+    int64_t mtime = 0;
+
+    // Compare the name of an entry with a lookup key bytewise
+    int compare(const ArchiveEntry &entry, const char *name, size_t length) {
+
+        const char *entryName = (const char*)pak.data + entry.name;
+        size_t min = entry.nameLength < length ? entry.nameLength : length;
+
+        int diff = memcmp(entryName, name, min);
+        if (diff != 0) {
+            return diff;
+
+        } else if (entry.nameLength == length) {
+            return 0;
+
+        } else {
+            return entry.nameLength < length ? -1 : 1;
+        }
+
+    }
+
+    bool validate() {
+
+        if (pak.size < (int64_t)sizeof(ArchiveHeader)) {
+            return false;
+        }
+
+        const ArchiveHeader *header = (const ArchiveHeader*)pak.data;
+        if (memcmp(header->magic, ARCHIVE_MAGIC, 4) != 0 || header->version != ARCHIVE_VERSION) {
+            return false;
+        }
+
+        uint64_t size = (uint64_t)pak.size;
+        if (sizeof(ArchiveHeader) + (uint64_t)header->count * sizeof(ArchiveEntry) > size) {
+            return false;
+        }
+
+        const ArchiveEntry *list = (const ArchiveEntry*)((const char*)pak.data + sizeof(ArchiveHeader));
+        for(uint32_t i = 0; i < header->count; i++) {
+
+            const ArchiveEntry &e = list[i];
+            if ((uint64_t)e.name + e.nameLength > size || e.offset > size || e.size > size - e.offset) {
+                return false;
+            }
+
+        }
+
+        entries = list;
+        count = header->count;
+        return true;
+
+    }
+
+
+    // Methods ----------------------------------------------------------------
+    bool open(const std::string filename) {
+
+        close();
+
+        if (!file::map(filename, &pak) && !file::read(filename, &pak)) {
+            return false;
+        }
+
+        if (!validate()) {
+            debugArgs("io::archive", "Invalid archive '%s'", filename.data());
+            close();
+            return false;
+        }
+
+        // Entries have no timestamps of their own
+        int64_t size;
+        file::stat(filename, &size, &mtime);
+
+        debugArgs("io::archive", "Mapped '%s', %d entries", filename.data(), (int)count);
+        return true;
+
+    }
+
+    bool find(const std::string filename, FileBuffer *buf) {
+
+        if (count == 0) {
+            return false;
+        }
+
+        // Archive names never start with ./
+        const char *name = filename.data();
+        size_t length = filename.length();
+        while (length > 2 && name[0] == '.' && name[1] == '/') {
+            name += 2;
+            length -= 2;
+        }
+
+        uint32_t low = 0, high = count;
+        while (low < high) {
+
+            uint32_t mid = low + (high - low) / 2;
+            int diff = compare(entries[mid], name, length);
+            if (diff < 0) {
+                low = mid + 1;
+
+            } else if (diff > 0) {
+                high = mid;
+
+            } else {
+
+                const ArchiveEntry &e = entries[mid];
+                if (e.compression != ARCHIVE_COMPRESSION_NONE) {
+                    debugArgs("io::archive", "Unsupported compression for '%s'", filename.data());
+                    return false;
+                }
+
+                buf->data = (char*)pak.data + e.offset;
+                buf->size = (int64_t)e.size;
+                buf->type = FILE_BUFFER_ARCHIVE;
+                return true;
+
+            }
+
+        }
+
+        return false;
+
+    }
+
+    int64_t modified() {
+        return mtime;
+    }
+
+    void close() {
+        file::release(&pak);
+        entries = NULL;
+        count = 0;
+        mtime = 0;
+    }
+
+}}}
+
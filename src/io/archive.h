@@ -0,0 +1,63 @@
+// Copyright (c) 2012 Ivo Wetzel.
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <stdint.h>
+
+// Archive Layout -------------------------------------------------------------
+//
+// All values are little endian.
+//
+//   ArchiveHeader
+//   ArchiveEntry[count]     sorted by name (bytewise) for binary search
+//   char[]                  name table, names are not null terminated
+//   data                    every entry starts on a ARCHIVE_ALIGN boundary
+//
+#define ARCHIVE_MAGIC "WPAK"
+#define ARCHIVE_VERSION 1
+#define ARCHIVE_ALIGN 16
+
+typedef enum ARCHIVE_COMPRESSION {
+    ARCHIVE_COMPRESSION_NONE = 0
+
+} ARCHIVE_COMPRESSION;
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t count;
+    uint32_t reserved;
+
+} ArchiveHeader;
+
+typedef struct {
+    uint32_t name;          // offset into the file
+    uint32_t nameLength;
+    uint64_t offset;        // offset into the file
+    uint64_t size;          // stored size
+    uint64_t length;        // size after decompression
+    uint32_t compression;
+    uint32_t reserved;
+
+} ArchiveEntry;
+
+#endif
+
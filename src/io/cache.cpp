@@ -0,0 +1,198 @@
+// Copyright (c) 2012 Ivo Wetzel.
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+#include "../Game.h"
+#include <stdio.h>
+#include <string.h>
+
+// Decoded images are kept as raw premultiplied RGBA next to the game
+#define CACHE_DIRECTORY ".cache/images/"
+#define CACHE_MAGIC "WRAW"
+#define CACHE_VERSION 1
+#define CACHE_ALIGN 16
+
+namespace Game { namespace io { namespace cache {
+
+    // Structs ----------------------------------------------------------------
+    //
+    // CacheHeader, the source path, padding up to CACHE_ALIGN and then
+    // width * height * 4 bytes of ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE pixels
+    //
+    typedef struct {
+        char magic[4];
+        uint32_t version;
+        uint32_t width;
+        uint32_t height;
+        int64_t size;
+        int64_t mtime;
+        uint32_t pathLength;
+        uint32_t reserved;
+
+    } CacheHeader;
+
+
+    // Helpers ----------------------------------------------------------------
+    std::string cacheName(const std::string filename) {
+
+        // FNV-1a over the source path
+        uint64_t hash = 14695981039346656037ULL;
+        for(unsigned int i = 0; i < filename.length(); i++) {
+            hash ^= (unsigned char)filename[i];
+            hash *= 1099511628211ULL;
+        }
+
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx.raw", (unsigned long long)hash);
+        return std::string(CACHE_DIRECTORY) + name;
+
+    }
+
+    uint64_t dataOffset(uint32_t pathLength) {
+        uint64_t offset = sizeof(CacheHeader) + pathLength;
+        return (offset + CACHE_ALIGN - 1) & ~(uint64_t)(CACHE_ALIGN - 1);
+    }
+
+    // Copy rows between the tightly packed cache and a locked region
+    void copyPixels(uint8_t *dst, int dstPitch, const uint8_t *src, int srcPitch, int width, int height) {
+
+        int row = width * 4;
+        if (dstPitch == row && srcPitch == row) {
+            memcpy(dst, src, (size_t)row * height);
+
+        } else {
+            for(int y = 0; y < height; y++) {
+                memcpy(dst + y * dstPitch, src + y * srcPitch, row);
+            }
+        }
+
+    }
+
+
+    // Methods ----------------------------------------------------------------
+    ALLEGRO_BITMAP *load(const std::string filename) {
+
+        int64_t size, mtime;
+        if (!file::stat(filename, &size, &mtime)) {
+            return NULL;
+        }
+
+        FileBuffer buf;
+        std::string name = cacheName(filename);
+        if (!file::map(name, &buf) && !file::read(name, &buf)) {
+            return NULL;
+        }
+
+        // Anything which doesn't match exactly is stale
+        const CacheHeader *header = static_cast<const CacheHeader*>(buf.data);
+        const char *path = static_cast<const char*>(buf.data) + sizeof(CacheHeader);
+        if (buf.size < (int64_t)sizeof(CacheHeader)
+            || memcmp(header->magic, CACHE_MAGIC, 4) != 0
+            || header->version != CACHE_VERSION
+            || header->size != size || header->mtime != mtime
+            || header->pathLength != filename.length()
+            || buf.size < (int64_t)(dataOffset(header->pathLength) + (uint64_t)header->width * header->height * 4)
+            || memcmp(path, filename.data(), header->pathLength) != 0) {
+
+            debugArgs("io::cache", "Stale entry for '%s'", filename.data());
+            file::release(&buf);
+            return NULL;
+
+        }
+
+        ALLEGRO_BITMAP *bitmap = al_create_bitmap(header->width, header->height);
+        if (bitmap) {
+
+            ALLEGRO_LOCKED_REGION *region = al_lock_bitmap(bitmap, ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE, ALLEGRO_LOCK_WRITEONLY);
+            if (region) {
+                const uint8_t *pixels = static_cast<const uint8_t*>(buf.data) + dataOffset(header->pathLength);
+                copyPixels(static_cast<uint8_t*>(region->data), region->pitch, pixels, header->width * 4,
+                           header->width, header->height);
+
+                al_unlock_bitmap(bitmap);
+
+            } else {
+                al_destroy_bitmap(bitmap);
+                bitmap = NULL;
+            }
+
+        }
+
+        file::release(&buf);
+        return bitmap;
+
+    }
+
+    void store(const std::string filename, ALLEGRO_BITMAP *bitmap) {
+
+        int64_t size, mtime;
+        if (!file::stat(filename, &size, &mtime)) {
+            return;
+        }
+
+        ALLEGRO_LOCKED_REGION *region = al_lock_bitmap(bitmap, ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE, ALLEGRO_LOCK_READONLY);
+        if (region == NULL) {
+            return;
+        }
+
+        CacheHeader header;
+        memcpy(header.magic, CACHE_MAGIC, 4);
+        header.version = CACHE_VERSION;
+        header.width = al_get_bitmap_width(bitmap);
+        header.height = al_get_bitmap_height(bitmap);
+        header.size = size;
+        header.mtime = mtime;
+        header.pathLength = filename.length();
+        header.reserved = 0;
+
+        uint64_t offset = dataOffset(header.pathLength);
+        std::vector<uint8_t> data(offset + (uint64_t)header.width * header.height * 4, 0);
+        memcpy(&data[0], &header, sizeof(CacheHeader));
+        memcpy(&data[sizeof(CacheHeader)], filename.data(), header.pathLength);
+        copyPixels(&data[offset], header.width * 4, static_cast<const uint8_t*>(region->data), region->pitch,
+                   header.width, header.height);
+
+        al_unlock_bitmap(bitmap);
+
+        // Write to a temporary file first so a crash never leaves a
+        // truncated entry behind
+        std::string name = cacheName(filename);
+        std::string temp = name + ".tmp";
+
+        al_make_directory(CACHE_DIRECTORY);
+        ALLEGRO_FILE *fp = al_fopen(temp.data(), "wb");
+        if (fp == NULL) {
+            debugArgs("io::cache", "Failed to create '%s'", temp.data());
+            return;
+        }
+
+        bool written = al_fwrite(fp, &data[0], data.size()) == data.size();
+        al_fclose(fp);
+
+        if (!written || rename(temp.data(), name.data()) != 0) {
+            debugArgs("io::cache", "Failed to write '%s'", name.data());
+            remove(temp.data());
+
+        } else {
+            debugArgs("io::cache", "Stored '%s'", filename.data());
+        }
+
+    }
+
+}}}
+
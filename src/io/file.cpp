@@ -19,55 +19,163 @@
 // THE SOFTWARE.
 #include "../Game.h"
 
+#if defined(__unix__) || defined(__APPLE__)
+#define HAS_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 namespace Game { namespace io { namespace file {
 
-    // TODO add switch for memory / disk files
-    // and mopve the al_open_memfile here
-    void *load(std::string filename, int64_t *len) {
+    // Map the file read only and hand the pages straight to the decoder
+    bool map(const std::string filename, FileBuffer *buf) {
+
+#ifdef HAS_MMAP
+        int fd = ::open(filename.data(), O_RDONLY);
+        if (fd == -1) {
+            return false;
+        }
+
+        struct stat info;
+        if (fstat(fd, &info) == -1 || info.st_size <= 0) {
+            ::close(fd);
+            return false;
+        }
+
+        void *data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        // The mapping stays valid after the descriptor is gone
+        ::close(fd);
+
+        if (data == MAP_FAILED) {
+            return false;
+        }
+
+        // Decoders read the whole file right away, start paging it in now
+        madvise(data, (size_t)info.st_size, MADV_WILLNEED);
+
+        buf->data = data;
+        buf->size = info.st_size;
+        buf->type = FILE_BUFFER_MAPPED;
+        return true;
+
+#else
+        return false;
+#endif
+
+    }
+
+    // Fallback which copies the whole file into the heap
+    bool read(const std::string filename, FileBuffer *buf) {
         
-        ALLEGRO_FILE* file = al_fopen(filename.data(), "r");
+        ALLEGRO_FILE* file = al_fopen(filename.data(), "rb");
         if (file) {
+
             int64_t size = al_fsize(file);
-            void* buffer = al_malloc((size_t)size);
-            al_fread(file, buffer, size);
+            void* data = al_malloc((size_t)size);
+            if (data == NULL || al_fread(file, data, size) != (size_t)size) {
+                al_free(data);
+                al_fclose(file);
+                return false;
+            }
+
             al_fclose(file);
 
-            *len = size;
-            return buffer;
+            buf->data = data;
+            buf->size = size;
+            buf->type = FILE_BUFFER_HEAP;
+            return true;
 
         } else {
-            *len = -1;
-            return NULL;
+            return false;
         }
 
     }
 
-    ALLEGRO_FILE *open(const std::string filename, void **rbuf) {
+    void release(FileBuffer *buf) {
+
+        // Archive buffers point into the archive mapping
+        if (buf->data != NULL && buf->type == FILE_BUFFER_HEAP) {
+            al_free(buf->data);
+
+#ifdef HAS_MMAP
+        } else if (buf->data != NULL && buf->type == FILE_BUFFER_MAPPED) {
+            munmap(buf->data, (size_t)buf->size);
+#endif
+        }
+
+        buf->data = NULL;
+        buf->size = 0;
+        buf->type = FILE_BUFFER_HEAP;
+
+    }
+
+    // Size and modification time, archive entries share the archive's time
+    bool stat(const std::string filename, int64_t *size, int64_t *mtime) {
+
+        FileBuffer buf;
+        if (archive::find(filename, &buf)) {
+            *size = buf.size;
+            *mtime = archive::modified();
+            return true;
+        }
+
+        ALLEGRO_FS_ENTRY *entry = al_create_fs_entry(filename.data());
+        if (entry == NULL) {
+            return false;
+        }
+
+        bool exists = al_fs_entry_exists(entry);
+        if (exists) {
+            *size = al_get_fs_entry_size(entry);
+            *mtime = al_get_fs_entry_mtime(entry);
+        }
+
+        al_destroy_fs_entry(entry);
+        return exists;
+
+    }
+
+    ALLEGRO_FILE *open(const std::string filename, FileBuffer *buf) {
 
         debugArgs("io::file", "Loading '%s'...", filename.data());
 
-        int64_t len;
-        void *buf = load(filename, &len);
+        static const char *sources[] = { "", " (mapped)", " (archive)" };
 
-        if (buf == NULL) {
+        buf->data = NULL;
+        buf->size = 0;
+        buf->type = FILE_BUFFER_HEAP;
+
+        if (!archive::find(filename, buf) && !map(filename, buf) && !read(filename, buf)) {
             debugArgs("io::file", "Failed to load '%s'", filename.data());
             return NULL;
 
         } else {
-            *rbuf = buf;
-            debugArgs("io::file", "Loaded '%s', %d bytes", filename.data(), (int)len);
-            return al_open_memfile(buf, len, "r");
+
+            debugArgs("io::file", "Loaded '%s', %d bytes%s", filename.data(), (int)buf->size,
+                                  sources[buf->type]);
+
+            // Memfiles opened for reading never write to the buffer, which
+            // keeps them safe on top of read only pages
+            ALLEGRO_FILE *fp = al_open_memfile(buf->data, buf->size, "r");
+            if (fp == NULL) {
+                release(buf);
+            }
+
+            return fp;
+
         }
 
     }
 
-    bool close(ALLEGRO_FILE *fp, void **rbuf) {
+    bool close(ALLEGRO_FILE *fp, FileBuffer *buf) {
 
         if (fp != NULL) {
             debugMsg("io::file", "Closed file");
             al_fclose(fp);
-            al_free(*rbuf);
-            *rbuf = NULL;
+            release(buf);
             return true;
 
         } else {
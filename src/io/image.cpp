@@ -27,7 +27,16 @@ namespace Game { namespace io { namespace image {
 
         ALLEGRO_BITMAP *img = NULL;
 
-        void *rbuf;
+        // Skip the codec if there is an up to date decoded copy
+        if (graphics.imageCache) {
+            img = cache::load(filename);
+            if (img) {
+                debugArgs("io::image", "Loaded '%s' from cache", filename.data());
+                return img;
+            }
+        }
+
+        FileBuffer rbuf;
         ALLEGRO_FILE *fp = file::open(filename, &rbuf);
 
         if (fp != NULL) {
@@ -35,6 +44,10 @@ namespace Game { namespace io { namespace image {
             img = al_load_bitmap_f(fp, ext.data());
             file::close(fp, &rbuf);
         } 
+
+        if (img && graphics.imageCache) {
+            cache::store(filename, img);
+        }
         
         if (img) {
             debugArgs("io::image", "Loaded '%s'", filename.data());
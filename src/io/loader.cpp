@@ -0,0 +1,294 @@
+// Copyright (c) 2012 Ivo Wetzel.
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+#include "../Game.h"
+#include <deque>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
+
+// Upper limit for worker threads decoding assets in the background
+#define MAX_LOADER_THREADS 8
+
+namespace Game { namespace io { namespace loader {
+
+    // Structs ----------------------------------------------------------------
+    typedef struct {
+        LOAD_TYPE type;
+        std::string filename;
+        LoadCallback callback;
+        void *data;
+        void *result;
+
+    } Job;
+
+    typedef std::deque<Job*> JobQueue;
+
+
+    // Workers ----------------------------------------------------------------
+    JobQueue *queued;
+    JobQueue *done;
+    ALLEGRO_THREAD *threads[MAX_LOADER_THREADS];
+    ALLEGRO_MUTEX *mutex;
+    ALLEGRO_COND *cond;
+    int threadCount;
+    unsigned int count;
+
+    // Jobs since the loader was last idle
+    unsigned int batchTotal;
+    unsigned int batchDone;
+    unsigned int batchFailed;
+
+    void *run(Job *job) {
+
+        switch(job->type) {
+            case LOAD_IMAGE:
+                return image::open(job->filename);
+
+            case LOAD_SAMPLE:
+                return sample::open(job->filename);
+
+            case LOAD_STREAM:
+                return stream::open(job->filename);
+
+            default:
+                return NULL;
+        }
+
+    }
+
+    void destroy(Job *job) {
+
+        if (job->result != NULL) {
+            switch(job->type) {
+                case LOAD_IMAGE:
+                    al_destroy_bitmap(static_cast<ALLEGRO_BITMAP*>(job->result));
+                    break;
+
+                case LOAD_SAMPLE:
+                    al_destroy_sample(static_cast<ALLEGRO_SAMPLE*>(job->result));
+                    break;
+
+                case LOAD_STREAM:
+                    al_destroy_audio_stream(static_cast<ALLEGRO_AUDIO_STREAM*>(job->result));
+                    break;
+            }
+        }
+
+        delete job;
+
+    }
+
+    void *work(ALLEGRO_THREAD *thread, void *arg) {
+
+        // There is no display on this thread, so bitmaps have to stay in
+        // memory until the main thread uploads them
+        al_set_new_bitmap_flags(ALLEGRO_MEMORY_BITMAP);
+
+        while(true) {
+
+            al_lock_mutex(mutex);
+            while(queued->empty() && !al_get_thread_should_stop(thread)) {
+                al_wait_cond(cond, mutex);
+            }
+
+            if (al_get_thread_should_stop(thread)) {
+                al_unlock_mutex(mutex);
+                break;
+            }
+
+            Job *job = queued->front();
+            queued->pop_front();
+            al_unlock_mutex(mutex);
+
+            job->result = run(job);
+
+            al_lock_mutex(mutex);
+            done->push_back(job);
+            al_unlock_mutex(mutex);
+
+        }
+
+        return NULL;
+
+    }
+
+    // One worker per core, leaving one for the main thread
+    int cores() {
+
+#ifdef _SC_NPROCESSORS_ONLN
+        long n = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+        return n < 1 ? 1 : (n > MAX_LOADER_THREADS ? MAX_LOADER_THREADS : (int)n);
+#else
+        return 2;
+#endif
+
+    }
+
+    // Threads are only started once something is actually loaded async
+    void start() {
+
+        mutex = al_create_mutex();
+        cond = al_create_cond();
+        threadCount = cores();
+
+        debugArgs("io::loader", "Starting %d worker(s)", threadCount);
+        for(int i = 0; i < threadCount; i++) {
+            threads[i] = al_create_thread(work, NULL);
+            al_start_thread(threads[i]);
+        }
+
+    }
+
+
+    // Methods ----------------------------------------------------------------
+    void init() {
+
+        queued = new JobQueue();
+        done = new JobQueue();
+        mutex = NULL;
+        cond = NULL;
+        threadCount = 0;
+        count = 0;
+
+        batchTotal = 0;
+        batchDone = 0;
+        batchFailed = 0;
+
+        for(int i = 0; i < MAX_LOADER_THREADS; i++) {
+            threads[i] = NULL;
+        }
+
+    }
+
+    void queue(LOAD_TYPE type, const std::string filename, LoadCallback callback, void *data) {
+
+        if (mutex == NULL) {
+            start();
+        }
+
+        Job *job = new Job();
+        job->type = type;
+        job->filename = filename;
+        job->callback = callback;
+        job->data = data;
+        job->result = NULL;
+
+        al_lock_mutex(mutex);
+        queued->push_back(job);
+        al_signal_cond(cond);
+        al_unlock_mutex(mutex);
+
+        if (count == 0) {
+            batchTotal = 0;
+            batchDone = 0;
+            batchFailed = 0;
+        }
+
+        batchTotal++;
+        count++;
+
+    }
+
+    unsigned int pending() {
+        return count;
+    }
+
+    unsigned int failed() {
+        return batchFailed;
+    }
+
+    float progress() {
+        return batchTotal > 0 ? (float)batchDone / batchTotal : 1.0f;
+    }
+
+    void update() {
+
+        if (count == 0) {
+            return;
+        }
+
+        JobQueue finished;
+        al_lock_mutex(mutex);
+        finished.swap(*done);
+        al_unlock_mutex(mutex);
+
+        for(JobQueue::iterator it = finished.begin(); it != finished.end(); it++) {
+            Job *job = *it;
+            if (job->result == NULL) {
+                batchFailed++;
+            }
+
+            batchDone++;
+            count--;
+
+            job->callback(job->result, job->data);
+            delete job;
+        }
+
+    }
+
+    void shutdown() {
+
+        debugMsg("io::loader", "Shutdown...");
+
+        if (mutex != NULL) {
+
+            // Wake up all workers so they notice they should stop
+            for(int i = 0; i < threadCount; i++) {
+                al_set_thread_should_stop(threads[i]);
+            }
+
+            al_lock_mutex(mutex);
+            al_broadcast_cond(cond);
+            al_unlock_mutex(mutex);
+
+            for(int i = 0; i < threadCount; i++) {
+                al_destroy_thread(threads[i]);
+                threads[i] = NULL;
+            }
+
+            al_destroy_cond(cond);
+            al_destroy_mutex(mutex);
+
+        }
+
+        // Throw away everything which never made it back to the game
+        for(JobQueue::iterator it = queued->begin(); it != queued->end(); it++) {
+            destroy(*it);
+        }
+
+        for(JobQueue::iterator it = done->begin(); it != done->end(); it++) {
+            destroy(*it);
+        }
+
+        if (count > 0) {
+            debugArgs("io::loader", "Discarded %d pending load(s)", (int)count);
+        }
+
+        queued->clear();
+        done->clear();
+        delete queued;
+        delete done;
+
+    }
+
+}}}
+
@@ -0,0 +1,194 @@
+// Copyright (c) 2012 Ivo Wetzel.
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+#include "../Game.h"
+#include <algorithm>
+#include <math.h>
+
+// Zero crossings of the windowed sinc on each side of a sample
+#define RESAMPLE_TAPS 16
+
+// Table entries per zero crossing, values in between are interpolated
+#define RESAMPLE_PHASES 256
+
+// Enough for 7.1
+#define RESAMPLE_MAX_CHANNELS 8
+
+namespace Game { namespace io { namespace resample {
+
+    // Kernel -----------------------------------------------------------------
+    std::vector<float> *kernel;
+
+    // Blackman windowed sinc, at x zero crossings from the center
+    float lookup(float x) {
+
+        float pos = x * RESAMPLE_PHASES;
+        unsigned int index = (unsigned int)pos;
+        if (index >= RESAMPLE_TAPS * RESAMPLE_PHASES) {
+            return 0.0f;
+        }
+
+        float a = (*kernel)[index];
+        float b = (*kernel)[index + 1];
+        return a + (b - a) * (pos - index);
+
+    }
+
+
+    // Conversion -------------------------------------------------------------
+
+    // Returns false for depths we don't convert
+    bool toFloat(const void *data, ALLEGRO_AUDIO_DEPTH depth, unsigned int count, float *out) {
+
+        unsigned int i;
+        switch(depth) {
+            case ALLEGRO_AUDIO_DEPTH_INT8:
+                for(i = 0; i < count; i++) out[i] = static_cast<const int8_t*>(data)[i] / 128.0f;
+                return true;
+
+            case ALLEGRO_AUDIO_DEPTH_UINT8:
+                for(i = 0; i < count; i++) out[i] = (static_cast<const uint8_t*>(data)[i] - 128) / 128.0f;
+                return true;
+
+            case ALLEGRO_AUDIO_DEPTH_INT16:
+                for(i = 0; i < count; i++) out[i] = static_cast<const int16_t*>(data)[i] / 32768.0f;
+                return true;
+
+            case ALLEGRO_AUDIO_DEPTH_UINT16:
+                for(i = 0; i < count; i++) out[i] = (static_cast<const uint16_t*>(data)[i] - 32768) / 32768.0f;
+                return true;
+
+            case ALLEGRO_AUDIO_DEPTH_FLOAT32:
+                std::copy(static_cast<const float*>(data), static_cast<const float*>(data) + count, out);
+                return true;
+
+            default:
+                return false;
+        }
+
+    }
+
+    void filter(const float *in, unsigned int inLength, float *out, unsigned int outLength,
+                unsigned int channels, double ratio) {
+
+        // When downsampling the cutoff drops to the new nyquist frequency
+        // and the kernel widens accordingly
+        float cutoff = std::min(1.0, 1.0 / ratio);
+        double width = RESAMPLE_TAPS / cutoff;
+
+        float sum[RESAMPLE_MAX_CHANNELS];
+        for(unsigned int i = 0; i < outLength; i++) {
+
+            double t = i * ratio;
+            int first = std::max((int)ceil(t - width), 0);
+            int last = std::min((int)floor(t + width), (int)inLength - 1);
+
+            for(unsigned int c = 0; c < channels; c++) {
+                sum[c] = 0.0f;
+            }
+
+            for(int k = first; k <= last; k++) {
+
+                float w = lookup(fabs(t - k) * cutoff);
+                const float *frame = in + k * channels;
+                for(unsigned int c = 0; c < channels; c++) {
+                    sum[c] += frame[c] * w;
+                }
+
+            }
+
+            for(unsigned int c = 0; c < channels; c++) {
+                out[i * channels + c] = sum[c] * cutoff;
+            }
+
+        }
+
+    }
+
+
+    // API --------------------------------------------------------------------
+    void init() {
+
+        debugMsg("io::resample", "Init...");
+
+        kernel = new std::vector<float>(RESAMPLE_TAPS * RESAMPLE_PHASES + 2, 0.0f);
+        for(unsigned int i = 0; i <= RESAMPLE_TAPS * RESAMPLE_PHASES; i++) {
+
+            double x = (double)i / RESAMPLE_PHASES;
+            double sinc = i == 0 ? 1.0 : sin(M_PI * x) / (M_PI * x);
+            double window = 0.42 + 0.5 * cos(M_PI * x / RESAMPLE_TAPS)
+                          + 0.08 * cos(2.0 * M_PI * x / RESAMPLE_TAPS);
+
+            (*kernel)[i] = sinc * window;
+
+        }
+
+    }
+
+    // Converts the sample to float at the given frequency, destroying the
+    // original, or returns it untouched if there's nothing to do
+    ALLEGRO_SAMPLE *convert(ALLEGRO_SAMPLE *sample, unsigned int frequency) {
+
+        unsigned int from = al_get_sample_frequency(sample);
+        ALLEGRO_AUDIO_DEPTH depth = al_get_sample_depth(sample);
+        if (kernel == NULL || (from == frequency && depth == ALLEGRO_AUDIO_DEPTH_FLOAT32)) {
+            return sample;
+        }
+
+        ALLEGRO_CHANNEL_CONF conf = al_get_sample_channels(sample);
+        unsigned int channels = al_get_channel_count(conf);
+        unsigned int length = al_get_sample_length(sample);
+        if (channels > RESAMPLE_MAX_CHANNELS || length == 0) {
+            return sample;
+        }
+
+        std::vector<float> in(length * channels);
+        if (!toFloat(al_get_sample_data(sample), depth, length * channels, &in[0])) {
+            return sample;
+        }
+
+        double ratio = (double)from / frequency;
+        unsigned int outLength = (unsigned int)ceil(length / ratio);
+        float *out = static_cast<float*>(al_malloc(outLength * channels * sizeof(float)));
+
+        if (from == frequency) {
+            std::copy(in.begin(), in.end(), out);
+
+        } else {
+            filter(&in[0], length, out, outLength, channels, ratio);
+        }
+
+        ALLEGRO_SAMPLE *converted = al_create_sample(out, outLength, frequency, ALLEGRO_AUDIO_DEPTH_FLOAT32, conf, true);
+        if (converted == NULL) {
+            al_free(out);
+            return sample;
+        }
+
+        al_destroy_sample(sample);
+        return converted;
+
+    }
+
+    void shutdown() {
+        delete kernel;
+        kernel = NULL;
+    }
+
+}}}
+
@@ -25,7 +25,7 @@ namespace Game { namespace io { namespace sample {
 
         debugArgs("io::sample", "Loading '%s'...", filename.data());
 
-        void *rbuf;
+        FileBuffer rbuf;
         ALLEGRO_FILE *fp  = file::open(filename, &rbuf);
         ALLEGRO_SAMPLE *sample = NULL;
 
@@ -34,6 +34,11 @@ namespace Game { namespace io { namespace sample {
             sample = al_load_sample_f(fp, ext.data());
             file::close(fp, &rbuf);
         } 
+
+        // Convert once here, instead of in the mixer on every play
+        if (sample && audio.resample && audio.frequency > 0) {
+            sample = resample::convert(sample, audio.frequency);
+        }
         
         if (sample) {
             debugArgs("io::sample", "Loaded '%s'", filename.data());
@@ -19,6 +19,10 @@
 // THE SOFTWARE.
 #include "../Game.h"
 
+// Fragments and samples per fragment kept in memory for each stream
+#define STREAM_BUFFERS 2
+#define STREAM_SAMPLES 4096
+
 namespace Game { namespace io { namespace stream {
 
     typedef std::map<const std::string, ALLEGRO_FILE*> StreamFileMap;
@@ -27,16 +31,27 @@ namespace Game { namespace io { namespace stream {
 
         debugArgs("io::stream", "Loading '%s'...", filename.data());
 
-        void *rbuf;
-        ALLEGRO_FILE *fp = file::open(filename, &rbuf);
-        ALLEGRO_AUDIO_STREAM *stream = NULL;
+        // Never read the whole file up front, the stream pulls in one
+        // fragment at a time. Archive entries are read straight from the
+        // mapping, which stays owned by the archive.
+        ALLEGRO_FILE *fp = NULL;
+        FileBuffer buf;
+        if (archive::find(filename, &buf)) {
+            fp = al_open_memfile(buf.data, buf.size, "r");
+
+        } else {
+            fp = al_fopen(filename.data(), "rb");
+        }
 
+        ALLEGRO_AUDIO_STREAM *stream = NULL;
         if (fp != NULL) {
             std::string ext = filename.substr(filename.find_last_of("."));
 
             // al_destroy_audio_stream() will close the file itself
-            stream = al_load_audio_stream_f(fp, ext.data(), 2, 4096);
-            //file::close(fp, &rbuf);
+            stream = al_load_audio_stream_f(fp, ext.data(), STREAM_BUFFERS, STREAM_SAMPLES);
+            if (stream == NULL) {
+                al_fclose(fp);
+            }
 
         } 
         
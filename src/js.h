@@ -47,5 +47,22 @@ inline std::string ToString(const v8::Handle<v8::Value> &f) {
     return std::string(*raw);
 }
 
+inline void *ToExternalArray(const v8::Handle<v8::Value> &f, v8::ExternalArrayType type, int *length) {
+
+    if (f->IsObject()) {
+        v8::Handle<v8::Object> obj = f->ToObject();
+        if (obj->HasIndexedPropertiesInExternalArrayData()
+            && obj->GetIndexedPropertiesExternalArrayDataType() == type) {
+
+            *length = obj->GetIndexedPropertiesExternalArrayDataLength();
+            return obj->GetIndexedPropertiesExternalArrayData();
+        }
+    }
+
+    *length = 0;
+    return NULL;
+
+}
+
 #endif
 
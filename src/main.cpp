@@ -18,12 +18,36 @@
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 // THE SOFTWARE.
 #include "Game.h"
+#include <stdlib.h>
+#include <string.h>
 
 int main(int argc, char* argv[]) {
     
     //setvbuf(stdout, NULL, _IOFBF, 8192);
+
+    std::string filename;
+    for(int i = 1; i < argc; i++) {
+
+        if (strcmp(argv[i], "--headless") == 0) {
+            Game::options.headless = true;
+
+        } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            Game::options.frames = atoi(argv[++i]);
+
+        } else if (strcmp(argv[i], "--benchmark") == 0 && i + 1 < argc) {
+            Game::options.benchmark = atoi(argv[++i]);
+            Game::options.frames = Game::options.benchmark;
+
+        } else if (strcmp(argv[i], "--report") == 0 && i + 1 < argc) {
+            Game::options.report = argv[++i];
+
+        } else {
+            filename = argv[i];
+        }
+
+    }
     
-    if (Game::init(argc > 1 ? std::string(argv[1]) : "")) {
+    if (Game::init(filename)) {
         return Game::loop();
 
     } else {
@@ -0,0 +1,267 @@
+// Copyright (c) 2012 Ivo Wetzel.
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+#include "../Game.h"
+#include <algorithm>
+#include <math.h>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+// Bus inputs above this peak level count as active for ducking
+#define BUS_DUCK_THRESHOLD 0.01f
+
+namespace Game { namespace mix { namespace bus {
+
+    // Structs ----------------------------------------------------------------
+
+    // Fields marked volatile are written by the main thread and read inside
+    // the mixer callback (or the other way round for peak). They're single
+    // aligned floats and ints, so a reader sees either the old or the new
+    // value, which is all the envelopes need
+    typedef struct {
+        ALLEGRO_MIXER *mixer;
+        float frequency;
+
+        // Volume, ramped towards target by step per sample frame
+        volatile float target;
+        volatile float step;
+        float gain;
+
+        // Sidechain ducking, the bus is turned down to duckLevel while the
+        // duckedBy bus plays something. attack and release are the seconds
+        // a change from silence to full volume takes
+        volatile int duckedBy;
+        volatile float duckLevel;
+        volatile float attack;
+        volatile float release;
+        float duck;
+
+        volatile float peak;
+
+    } Bus;
+
+    static const char *names[BUS_COUNT] = {
+        "music", "sfx", "ui", "voice"
+    };
+
+
+    // Mixing -----------------------------------------------------------------
+    static Bus buses[BUS_COUNT];
+
+    float peak(const float *buf, unsigned int count) {
+
+        unsigned int i = 0;
+        float p = 0.0f;
+
+#ifdef __SSE__
+        __m128 sign = _mm_set1_ps(-0.0f);
+        __m128 max = _mm_setzero_ps();
+        for(; i + 4 <= count; i += 4) {
+            max = _mm_max_ps(max, _mm_andnot_ps(sign, _mm_loadu_ps(buf + i)));
+        }
+
+        float lanes[4];
+        _mm_storeu_ps(lanes, max);
+        p = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+#endif
+
+        for(; i < count; i++) {
+            p = std::max(p, fabsf(buf[i]));
+        }
+
+        return p;
+
+    }
+
+    void scale(float *buf, unsigned int count, float gain) {
+
+        unsigned int i = 0;
+
+#ifdef __SSE__
+        __m128 g = _mm_set1_ps(gain);
+        for(; i + 4 <= count; i += 4) {
+            _mm_storeu_ps(buf + i, _mm_mul_ps(_mm_loadu_ps(buf + i), g));
+        }
+#endif
+
+        for(; i < count; i++) {
+            buf[i] *= gain;
+        }
+
+    }
+
+    float approach(float value, float target, float step) {
+        return value < target ? std::min(value + step, target) : std::max(value - step, target);
+    }
+
+    // Runs on the audio thread for every fragment the bus mixes
+    void process(void *data, unsigned int samples, void *userdata) {
+
+        Bus *bus = static_cast<Bus*>(userdata);
+        float *buf = static_cast<float*>(data);
+        unsigned int count = samples * 2;
+
+        // Measured before the gain, so a quiet voice bus still ducks
+        bus->peak = peak(buf, count);
+
+        // The other bus was measured one fragment ago, which is well below
+        // the attack time of any useful ducking
+        int by = bus->duckedBy;
+        bool active = by >= 0 && buses[by].peak > BUS_DUCK_THRESHOLD;
+
+        float duck = active ? bus->duckLevel : 1.0f;
+        float time = active ? bus->attack : bus->release;
+        float duckStep = time > 0.0f ? 1.0f / (time * bus->frequency) : 1.0f;
+
+        float target = bus->target;
+        float step = bus->step;
+
+        // Steady state, a single vectorized multiply
+        if (bus->gain == target && bus->duck == duck) {
+            if (target * duck != 1.0f) {
+                scale(buf, count, target * duck);
+            }
+            return;
+        }
+
+        for(unsigned int i = 0; i < count; i += 2) {
+            bus->gain = approach(bus->gain, target, step);
+            bus->duck = approach(bus->duck, duck, duckStep);
+
+            float g = bus->gain * bus->duck;
+            buf[i] *= g;
+            buf[i + 1] *= g;
+        }
+
+    }
+
+
+    // API --------------------------------------------------------------------
+    void init(ALLEGRO_MIXER *parent) {
+
+        debugMsg("mix::bus", "Init...");
+
+        unsigned int frequency = al_get_mixer_frequency(parent);
+        for(int i = 0; i < BUS_COUNT; i++) {
+
+            Bus *bus = &buses[i];
+            bus->frequency = frequency;
+            bus->target = 1.0f;
+            bus->step = 1.0f;
+            bus->gain = 1.0f;
+            bus->duckedBy = -1;
+            bus->duckLevel = 1.0f;
+            bus->attack = 0.0f;
+            bus->release = 0.0f;
+            bus->duck = 1.0f;
+            bus->peak = 0.0f;
+
+            // Mixers feeding other mixers have to be float
+            bus->mixer = al_create_mixer(frequency, ALLEGRO_AUDIO_DEPTH_FLOAT32, ALLEGRO_CHANNEL_CONF_2);
+            if (bus->mixer == NULL || !al_attach_mixer_to_mixer(bus->mixer, parent)) {
+                debugArgs("mix::bus", "Failed to create bus '%s'", names[i]);
+
+                // An unattached mixer would play silently
+                if (bus->mixer) {
+                    al_destroy_mixer(bus->mixer);
+                    bus->mixer = NULL;
+                }
+
+                continue;
+            }
+
+            al_set_mixer_postprocess_callback(bus->mixer, process, bus);
+
+        }
+
+    }
+
+    // Falls back to the default mixer, e.g. when a bus failed to create
+    ALLEGRO_MIXER *mixer(AUDIO_BUS bus) {
+
+        if (buses[bus].mixer) {
+            return buses[bus].mixer;
+
+        } else {
+            return al_get_default_mixer();
+        }
+
+    }
+
+    int find(const std::string name) {
+
+        for(int i = 0; i < BUS_COUNT; i++) {
+            if (name == names[i]) {
+                return i;
+            }
+        }
+
+        return -1;
+
+    }
+
+    const char *name(AUDIO_BUS bus) {
+        return names[bus];
+    }
+
+    void setGain(AUDIO_BUS bus, float gain, float duration) {
+
+        Bus *b = &buses[bus];
+        float distance = fabsf(gain - b->gain);
+        b->step = duration > 0.0f && b->frequency > 0.0f ? distance / (duration * b->frequency) : 1.0f;
+        b->target = gain;
+
+    }
+
+    float getGain(AUDIO_BUS bus) {
+        return buses[bus].target;
+    }
+
+    void duck(AUDIO_BUS bus, AUDIO_BUS by, float level, float attack, float release) {
+
+        Bus *b = &buses[bus];
+        b->duckLevel = level;
+        b->attack = attack;
+        b->release = release;
+        b->duckedBy = by;
+
+    }
+
+    void unduck(AUDIO_BUS bus) {
+        buses[bus].duckedBy = -1;
+    }
+
+    void shutdown() {
+
+        debugMsg("mix::bus", "Shutdown...");
+
+        for(int i = 0; i < BUS_COUNT; i++) {
+            if (buses[i].mixer) {
+                al_detach_mixer(buses[i].mixer);
+                al_destroy_mixer(buses[i].mixer);
+                buses[i].mixer = NULL;
+            }
+        }
+
+    }
+
+}}}
+
@@ -0,0 +1,344 @@
+// Copyright (c) 2012 Ivo Wetzel.
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+#include "../Game.h"
+#include <algorithm>
+#include <math.h>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+// Exponential ramps can't reach or start from silence, they run from and to
+// this level (-80dB) instead and snap to the exact value at their end
+#define RAMP_FLOOR 0.0001f
+
+// Orders the ramp writes against the sequence updates, see set()
+#define MIX_BARRIER() __sync_synchronize()
+
+namespace Game { namespace mix { namespace channel {
+
+    // Structs ----------------------------------------------------------------
+    typedef struct {
+        unsigned int serial;
+        bool jump;
+        float from;
+        float to;
+        float frames;
+        RAMP_CURVE curve;
+
+    } Ramp;
+
+    // A child mixer between a sound source and its bus. The main thread
+    // only schedules ramps, the postprocess callback evaluates them for
+    // every sample frame it mixes
+    struct Channel {
+        ALLEGRO_MIXER *mixer;
+        AUDIO_BUS bus;
+        float frequency;
+
+        // Seqlock, odd while the main thread is writing ramps
+        volatile unsigned int sequence;
+        Ramp ramps[CHANNEL_PARAMS];
+
+        // Only touched by the audio thread
+        unsigned int seen;
+        unsigned int serial[CHANNEL_PARAMS];
+        float value[CHANNEL_PARAMS];
+        float target[CHANNEL_PARAMS];
+        float step[CHANNEL_PARAMS];
+        bool exponential[CHANNEL_PARAMS];
+        unsigned int remaining[CHANNEL_PARAMS];
+
+        // Published by the audio thread after every block
+        volatile float current[CHANNEL_PARAMS];
+
+    };
+
+
+    // Mixing -----------------------------------------------------------------
+
+    // Copies the ramps unless the main thread is in the middle of writing
+    // them, in that case the next block tries again
+    bool read(Channel *c, Ramp *ramps, unsigned int *sequence) {
+
+        unsigned int before = c->sequence;
+        if (before & 1) {
+            return false;
+        }
+
+        MIX_BARRIER();
+        for(int i = 0; i < CHANNEL_PARAMS; i++) {
+            ramps[i] = c->ramps[i];
+        }
+        MIX_BARRIER();
+
+        *sequence = before;
+        return c->sequence == before;
+
+    }
+
+    void start(Channel *c, int p, const Ramp *ramp) {
+
+        float from = ramp->jump ? ramp->from : c->value[p];
+
+        c->serial[p] = ramp->serial;
+        c->target[p] = ramp->to;
+        c->remaining[p] = (unsigned int)std::max(ramp->frames, 0.0f);
+        c->exponential[p] = false;
+        c->value[p] = from;
+
+        if (c->remaining[p] == 0) {
+            c->value[p] = ramp->to;
+
+        // Only makes sense for gain, pan passes through zero
+        } else if (ramp->curve == RAMP_EXPONENTIAL && p == CHANNEL_GAIN) {
+            from = std::max(from, RAMP_FLOOR);
+            c->value[p] = from;
+            c->step[p] = powf(std::max(ramp->to, RAMP_FLOOR) / from, 1.0f / c->remaining[p]);
+            c->exponential[p] = true;
+
+        } else {
+            c->step[p] = (ramp->to - from) / c->remaining[p];
+        }
+
+    }
+
+    void advance(Channel *c, int p) {
+
+        if (c->remaining[p] > 0) {
+
+            c->value[p] = c->exponential[p] ? c->value[p] * c->step[p]
+                                            : c->value[p] + c->step[p];
+
+            if (--c->remaining[p] == 0) {
+                c->value[p] = c->target[p];
+            }
+
+        }
+
+    }
+
+    // Per channel gains for a stereo balance
+    void balance(const Channel *c, float *left, float *right) {
+        float gain = c->value[CHANNEL_GAIN];
+        float pan = c->value[CHANNEL_PAN];
+        *left = gain * std::min(1.0f - pan, 1.0f);
+        *right = gain * std::min(1.0f + pan, 1.0f);
+    }
+
+    void scale(float *buf, unsigned int count, float left, float right) {
+
+        unsigned int i = 0;
+
+#ifdef __SSE__
+        __m128 g = _mm_setr_ps(left, right, left, right);
+        for(; i + 4 <= count; i += 4) {
+            _mm_storeu_ps(buf + i, _mm_mul_ps(_mm_loadu_ps(buf + i), g));
+        }
+#endif
+
+        for(; i < count; i += 2) {
+            buf[i] *= left;
+            buf[i + 1] *= right;
+        }
+
+    }
+
+    void process(void *data, unsigned int samples, void *userdata) {
+
+        Channel *c = static_cast<Channel*>(userdata);
+        float *buf = static_cast<float*>(data);
+        unsigned int count = samples * 2;
+
+        // Pick up ramps scheduled since the last block
+        unsigned int sequence = c->sequence;
+        if (sequence != c->seen) {
+
+            Ramp ramps[CHANNEL_PARAMS];
+            if (read(c, ramps, &sequence)) {
+
+                for(int i = 0; i < CHANNEL_PARAMS; i++) {
+                    if (ramps[i].serial != c->serial[i]) {
+                        start(c, i, &ramps[i]);
+                    }
+                }
+
+                c->seen = sequence;
+
+            }
+
+        }
+
+        float left, right;
+        if (c->remaining[CHANNEL_GAIN] == 0 && c->remaining[CHANNEL_PAN] == 0) {
+
+            balance(c, &left, &right);
+            if (left != 1.0f || right != 1.0f) {
+                scale(buf, count, left, right);
+            }
+
+        } else {
+
+            for(unsigned int i = 0; i < count; i += 2) {
+                advance(c, CHANNEL_GAIN);
+                advance(c, CHANNEL_PAN);
+                balance(c, &left, &right);
+                buf[i] *= left;
+                buf[i + 1] *= right;
+            }
+
+        }
+
+        for(int i = 0; i < CHANNEL_PARAMS; i++) {
+            c->current[i] = c->value[i];
+        }
+
+    }
+
+
+    // API --------------------------------------------------------------------
+    Channel *create(AUDIO_BUS bus, float gain, float pan) {
+
+        Channel *c = new Channel();
+        c->bus = bus;
+        c->mixer = NULL;
+        c->frequency = 0;
+        c->sequence = 0;
+        c->seen = 0;
+
+        for(int i = 0; i < CHANNEL_PARAMS; i++) {
+            c->ramps[i].serial = 0;
+            c->ramps[i].jump = false;
+            c->ramps[i].from = 0;
+            c->ramps[i].frames = 0;
+            c->ramps[i].curve = RAMP_LINEAR;
+            c->serial[i] = 0;
+            c->step[i] = 0;
+            c->exponential[i] = false;
+            c->remaining[i] = 0;
+        }
+
+        c->value[CHANNEL_GAIN] = c->target[CHANNEL_GAIN] = c->current[CHANNEL_GAIN] = gain;
+        c->value[CHANNEL_PAN] = c->target[CHANNEL_PAN] = c->current[CHANNEL_PAN] = pan;
+        c->ramps[CHANNEL_GAIN].to = gain;
+        c->ramps[CHANNEL_PAN].to = pan;
+
+        // Without audio output there's nothing to attach to
+        ALLEGRO_MIXER *parent = bus::mixer(bus);
+        if (parent) {
+            c->frequency = al_get_mixer_frequency(parent);
+            c->mixer = al_create_mixer(al_get_mixer_frequency(parent), ALLEGRO_AUDIO_DEPTH_FLOAT32, ALLEGRO_CHANNEL_CONF_2);
+            if (c->mixer) {
+                al_set_mixer_postprocess_callback(c->mixer, process, c);
+                al_attach_mixer_to_mixer(c->mixer, parent);
+            }
+        }
+
+        return c;
+
+    }
+
+    ALLEGRO_MIXER *mixer(Channel *c) {
+
+        if (c->mixer) {
+            return c->mixer;
+
+        } else {
+            return bus::mixer(c->bus);
+        }
+
+    }
+
+    // Attached mixers are cleared and mixed on every fragment, even if
+    // nothing plays on them
+    void detach(Channel *c) {
+        if (c->mixer && al_get_mixer_attached(c->mixer)) {
+            al_detach_mixer(c->mixer);
+        }
+    }
+
+    // Also attaches channels which were detached while idle
+    void attach(Channel *c, AUDIO_BUS bus) {
+
+        if (c->mixer && bus != c->bus) {
+            detach(c);
+        }
+
+        c->bus = bus;
+        if (c->mixer && !al_get_mixer_attached(c->mixer)) {
+            al_attach_mixer_to_mixer(c->mixer, bus::mixer(bus));
+        }
+
+    }
+
+    void schedule(Channel *c, CHANNEL_PARAM param, bool jump, float from, float to, float duration, RAMP_CURVE curve) {
+
+        c->sequence++;
+        MIX_BARRIER();
+
+        Ramp *ramp = &c->ramps[param];
+        ramp->serial++;
+        ramp->jump = jump;
+        ramp->from = from;
+        ramp->to = to;
+        ramp->frames = duration * c->frequency;
+        ramp->curve = curve;
+
+        MIX_BARRIER();
+        c->sequence++;
+
+        // Nothing runs the callback without a mixer
+        if (c->mixer == NULL) {
+            c->value[param] = to;
+            c->current[param] = to;
+        }
+
+    }
+
+    // Ramps from wherever the channel is right now
+    void set(Channel *c, CHANNEL_PARAM param, float to, float duration, RAMP_CURVE curve) {
+        schedule(c, param, false, 0.0f, to, duration, curve);
+    }
+
+    void ramp(Channel *c, CHANNEL_PARAM param, float from, float to, float duration, RAMP_CURVE curve) {
+        schedule(c, param, true, from, to, duration, curve);
+    }
+
+    float get(Channel *c, CHANNEL_PARAM param) {
+        return c->current[param];
+    }
+
+    RAMP_CURVE curve(const std::string name) {
+        return name == "exponential" ? RAMP_EXPONENTIAL : RAMP_LINEAR;
+    }
+
+    void destroy(Channel *c) {
+
+        if (c->mixer) {
+            al_detach_mixer(c->mixer);
+            al_destroy_mixer(c->mixer);
+        }
+
+        delete c;
+
+    }
+
+}}}
+
@@ -0,0 +1,281 @@
+// Copyright (c) 2012 Ivo Wetzel.
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+#include "../Game.h"
+#include <algorithm>
+
+// Size of a single atlas page, this is safe to use on pretty much all GPUs
+#define ATLAS_PAGE_SIZE 1024
+
+// Images above this size are not worth packing and stay on their own
+#define ATLAS_MAX_IMAGE_SIZE 512
+
+// Empty border around each packed image
+#define ATLAS_PADDING 1
+
+namespace Game { namespace render { namespace atlas {
+
+    // Structs ----------------------------------------------------------------
+    typedef struct {
+        int x;
+        int y;
+        int w;
+
+    } Node;
+
+    typedef std::vector<Node> Skyline;
+
+    typedef struct {
+        std::string group;
+        ALLEGRO_BITMAP *bitmap;
+        Skyline skyline;
+        int count;
+
+    } Page;
+
+    typedef std::vector<Page*> PageList;
+
+
+    // Packing ----------------------------------------------------------------
+    PageList *pages;
+
+    // Returns the lowest y at which a rect of w * h fits onto the skyline
+    // when placed at the start of the given node, or -1 if it does not fit
+    int fitSkyline(const Page *page, unsigned int index, int w, int h) {
+
+        const Skyline &skyline = page->skyline;
+        if (skyline[index].x + w > ATLAS_PAGE_SIZE) {
+            return -1;
+        }
+
+        int y = skyline[index].y;
+        int left = w;
+        while(left > 0) {
+
+            if (index >= skyline.size()) {
+                return -1;
+            }
+
+            y = std::max(y, skyline[index].y);
+            if (y + h > ATLAS_PAGE_SIZE) {
+                return -1;
+            }
+
+            left -= skyline[index].w;
+            index++;
+
+        }
+
+        return y;
+
+    }
+
+    bool insertSkyline(Page *page, int w, int h, int *x, int *y) {
+
+        Skyline &skyline = page->skyline;
+
+        // Bottom left: pick the position with the lowest resulting top edge
+        int bestIndex = -1, bestTop = ATLAS_PAGE_SIZE + 1, bestWidth = 0;
+        for(unsigned int i = 0; i < skyline.size(); i++) {
+
+            int top = fitSkyline(page, i, w, h);
+            if (top >= 0 && (top + h < bestTop || (top + h == bestTop && skyline[i].w < bestWidth))) {
+                bestIndex = i;
+                bestTop = top + h;
+                bestWidth = skyline[i].w;
+                *x = skyline[i].x;
+                *y = top;
+            }
+
+        }
+
+        if (bestIndex == -1) {
+            return false;
+        }
+
+        // Raise the skyline and cut away the nodes now hidden below the rect
+        Node node = { *x, *y + h, w };
+        skyline.insert(skyline.begin() + bestIndex, node);
+
+        for(unsigned int i = bestIndex + 1; i < skyline.size(); i++) {
+
+            Node &prev = skyline[i - 1];
+            Node &cur = skyline[i];
+            if (cur.x < prev.x + prev.w) {
+
+                int shrink = prev.x + prev.w - cur.x;
+                cur.x += shrink;
+                cur.w -= shrink;
+
+                if (cur.w <= 0) {
+                    skyline.erase(skyline.begin() + i);
+                    i--;
+
+                } else {
+                    break;
+                }
+
+            } else {
+                break;
+            }
+
+        }
+
+        // Merge neighbours of the same height
+        for(unsigned int i = 0; i + 1 < skyline.size(); i++) {
+            if (skyline[i].y == skyline[i + 1].y) {
+                skyline[i].w += skyline[i + 1].w;
+                skyline.erase(skyline.begin() + i + 1);
+                i--;
+            }
+        }
+
+        return true;
+
+    }
+
+    Page *createPage(const std::string group) {
+
+        ALLEGRO_BITMAP *bitmap = al_create_bitmap(ATLAS_PAGE_SIZE, ATLAS_PAGE_SIZE);
+        if (bitmap == NULL) {
+            debugArgs("render::atlas", "Failed to create page for group '%s'", group.data());
+            return NULL;
+        }
+
+        ALLEGRO_BITMAP *target = al_get_target_bitmap();
+        al_set_target_bitmap(bitmap);
+        al_clear_to_color(al_map_rgba(0, 0, 0, 0));
+        al_set_target_bitmap(target);
+
+        Page *page = new Page();
+        page->group = group;
+        page->bitmap = bitmap;
+        page->count = 0;
+
+        Node node = { 0, 0, ATLAS_PAGE_SIZE };
+        page->skyline.push_back(node);
+        pages->push_back(page);
+
+        debugArgs("render::atlas", "Created page #%d for group '%s'", (int)pages->size(), group.data());
+        return page;
+
+    }
+
+
+    // Methods ----------------------------------------------------------------
+    void init() {
+        pages = new PageList();
+    }
+
+    ALLEGRO_BITMAP *add(ALLEGRO_BITMAP *bitmap, const std::string group) {
+
+        int w = al_get_bitmap_width(bitmap);
+        int h = al_get_bitmap_height(bitmap);
+        if (w > ATLAS_MAX_IMAGE_SIZE || h > ATLAS_MAX_IMAGE_SIZE) {
+            return NULL;
+        }
+
+        // Find a page of the group with enough space left, or start a new one
+        Page *page = NULL;
+        int x = 0, y = 0;
+        for(PageList::iterator it = pages->begin(); it != pages->end(); it++) {
+            if ((*it)->group == group && insertSkyline(*it, w + ATLAS_PADDING, h + ATLAS_PADDING, &x, &y)) {
+                page = *it;
+                break;
+            }
+        }
+
+        if (page == NULL) {
+            page = createPage(group);
+            if (page == NULL || !insertSkyline(page, w + ATLAS_PADDING, h + ATLAS_PADDING, &x, &y)) {
+                return NULL;
+            }
+        }
+
+        // Copy the pixels over as they are, without blending them into the page
+        int op, src, dst;
+        ALLEGRO_BITMAP *target = al_get_target_bitmap();
+        render::flush();
+
+        al_get_blender(&op, &src, &dst);
+        al_set_target_bitmap(page->bitmap);
+        al_set_blender(ALLEGRO_ADD, ALLEGRO_ONE, ALLEGRO_ZERO);
+        al_draw_bitmap(bitmap, x, y, 0);
+        al_set_blender(op, src, dst);
+        al_set_target_bitmap(target);
+
+        page->count++;
+        return al_create_sub_bitmap(page->bitmap, x, y, w, h);
+
+    }
+
+    // Space is not reused, pages are freed once all their images are gone
+    bool release(ALLEGRO_BITMAP *bitmap) {
+
+        ALLEGRO_BITMAP *parent = al_get_parent_bitmap(bitmap);
+        if (parent == NULL) {
+            return false;
+        }
+
+        for(PageList::iterator it = pages->begin(); it != pages->end(); it++) {
+
+            Page *page = *it;
+            if (page->bitmap == parent) {
+
+                // Queued sprites might still reference the region
+                render::flush();
+                al_destroy_bitmap(bitmap);
+                page->count--;
+
+                if (page->count == 0) {
+                    debugArgs("render::atlas", "Destroyed empty page for group '%s'", page->group.data());
+                    al_destroy_bitmap(page->bitmap);
+                    pages->erase(it);
+                    delete page;
+                }
+
+                return true;
+
+            }
+
+        }
+
+        return false;
+
+    }
+
+    int64_t bytes() {
+        return (int64_t)pages->size() * ATLAS_PAGE_SIZE * ATLAS_PAGE_SIZE * 4;
+    }
+
+    void shutdown() {
+
+        debugMsg("render::atlas", "Shutdown...");
+        for(PageList::iterator it = pages->begin(); it != pages->end(); it++) {
+            al_destroy_bitmap((*it)->bitmap);
+            delete *it;
+        }
+
+        pages->clear();
+        delete pages;
+
+    }
+
+}}}
+
@@ -0,0 +1,158 @@
+// Copyright (c) 2012 Ivo Wetzel.
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+#include "../Game.h"
+#include <algorithm>
+
+// How many runs back a sprite may be moved to join a run with the same texture
+#define MAX_BATCH_LOOKBACK 16
+
+namespace Game { namespace render { namespace batch {
+
+    // Structs ----------------------------------------------------------------
+    typedef struct {
+        ALLEGRO_BITMAP *bitmap;
+        ALLEGRO_COLOR tint;
+        float sx, sy, sw, sh;
+        float dx, dy;
+        int flags;
+        unsigned int run;
+
+    } Sprite;
+
+    // A run is a group of sprites which share the same texture and get drawn
+    // back to back during the flush
+    typedef struct {
+        ALLEGRO_BITMAP *texture;
+        float x1, y1, x2, y2;
+        unsigned int count;
+
+    } Run;
+
+    typedef std::vector<Sprite> SpriteList;
+    typedef std::vector<Run> RunList;
+    typedef std::vector<unsigned int> IndexList;
+
+
+    // Buffers ----------------------------------------------------------------
+    SpriteList *sprites;
+    RunList *runs;
+    IndexList *order;
+
+    unsigned int findRun(ALLEGRO_BITMAP *texture, float x1, float y1, float x2, float y2) {
+
+        // Walk back through the recent runs, a sprite can only join an earlier
+        // run if it does not overlap any of the runs which are drawn after it
+        int last = (int)runs->size() - 1;
+        for(int i = last; i >= 0 && i >= last - MAX_BATCH_LOOKBACK; i--) {
+
+            Run &run = (*runs)[i];
+            if (run.texture == texture) {
+                run.x1 = std::min(run.x1, x1);
+                run.y1 = std::min(run.y1, y1);
+                run.x2 = std::max(run.x2, x2);
+                run.y2 = std::max(run.y2, y2);
+                run.count++;
+                return i;
+
+            } else if (x1 < run.x2 && x2 > run.x1 && y1 < run.y2 && y2 > run.y1) {
+                break;
+            }
+
+        }
+
+        Run run = { texture, x1, y1, x2, y2, 1 };
+        runs->push_back(run);
+        return runs->size() - 1;
+
+    }
+
+
+    // Methods ----------------------------------------------------------------
+    void init() {
+        sprites = new SpriteList();
+        runs = new RunList();
+        order = new IndexList();
+    }
+
+    void draw(ALLEGRO_BITMAP *bitmap, float sx, float sy, float sw, float sh,
+              float dx, float dy, ALLEGRO_COLOR tint, int flags) {
+
+        if (!visible(dx, dy, dx + sw, dy + sh)) {
+            return;
+        }
+
+        // Sub bitmaps share the texture of their parent
+        ALLEGRO_BITMAP *texture = al_is_sub_bitmap(bitmap) ? al_get_parent_bitmap(bitmap) : bitmap;
+
+        // Primitives and sprites share the target, so keep their order intact
+        if (sprites->empty()) {
+            prim::flush();
+        }
+
+        Sprite sprite = { bitmap, tint, sx, sy, sw, sh, dx, dy, flags, 0 };
+        sprite.run = findRun(texture, dx, dy, dx + sw, dy + sh);
+        sprites->push_back(sprite);
+
+    }
+
+    void flush() {
+
+        if (sprites->empty()) {
+            return;
+        }
+
+        // Stable counting sort of the sprites by their run
+        unsigned int i, offset = 0;
+        IndexList offsets(runs->size());
+        for(i = 0; i < runs->size(); i++) {
+            offsets[i] = offset;
+            offset += (*runs)[i].count;
+        }
+
+        order->resize(sprites->size());
+        for(i = 0; i < sprites->size(); i++) {
+            (*order)[offsets[(*sprites)[i].run]++] = i;
+        }
+
+        al_hold_bitmap_drawing(true);
+        for(i = 0; i < order->size(); i++) {
+            const Sprite &s = (*sprites)[(*order)[i]];
+            al_draw_tinted_bitmap_region(s.bitmap, s.tint, s.sx, s.sy, s.sw, s.sh, s.dx, s.dy, s.flags);
+        }
+        al_hold_bitmap_drawing(false);
+
+        stats.batches += runs->size();
+        sprites->clear();
+        runs->clear();
+
+    }
+
+    void shutdown() {
+
+        debugMsg("render::batch", "Shutdown...");
+
+        delete sprites;
+        delete runs;
+        delete order;
+
+    }
+
+}}}
+
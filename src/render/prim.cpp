@@ -0,0 +1,119 @@
+// Copyright (c) 2012 Ivo Wetzel.
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+#include "../Game.h"
+#include <algorithm>
+#include <math.h>
+
+namespace Game { namespace render { namespace prim {
+
+    // Buffers ----------------------------------------------------------------
+    typedef std::vector<ALLEGRO_VERTEX> VertexList;
+    VertexList *vertices;
+
+    void vertex(float x, float y, const ALLEGRO_COLOR &color) {
+        ALLEGRO_VERTEX v = { x, y, 0, 0, 0, color };
+        vertices->push_back(v);
+    }
+
+    void quad(float x1, float y1, float x2, float y2, float x3, float y3,
+              float x4, float y4, const ALLEGRO_COLOR &color) {
+
+        float minX = std::min(std::min(x1, x2), std::min(x3, x4));
+        float minY = std::min(std::min(y1, y2), std::min(y3, y4));
+        float maxX = std::max(std::max(x1, x2), std::max(x3, x4));
+        float maxY = std::max(std::max(y1, y2), std::max(y3, y4));
+        if (!visible(minX, minY, maxX, maxY)) {
+            return;
+        }
+
+        // Primitives and sprites share the target, so keep their order intact
+        if (vertices->empty()) {
+            batch::flush();
+        }
+
+        vertex(x1, y1, color);
+        vertex(x2, y2, color);
+        vertex(x3, y3, color);
+        vertex(x1, y1, color);
+        vertex(x3, y3, color);
+        vertex(x4, y4, color);
+
+    }
+
+
+    // Methods ----------------------------------------------------------------
+    void init() {
+        vertices = new VertexList();
+    }
+
+    void line(float x1, float y1, float x2, float y2, ALLEGRO_COLOR color, float thickness) {
+
+        float dx = x2 - x1;
+        float dy = y2 - y1;
+        float len = sqrtf(dx * dx + dy * dy);
+        if (len == 0) {
+            return;
+        }
+
+        // Extrude the line sideways by half its thickness
+        float t = (thickness > 0 ? thickness : 1) * 0.5f;
+        float nx = -dy / len * t;
+        float ny = dx / len * t;
+        quad(x1 + nx, y1 + ny, x2 + nx, y2 + ny, x2 - nx, y2 - ny, x1 - nx, y1 - ny, color);
+
+    }
+
+    void rect(float x1, float y1, float x2, float y2, ALLEGRO_COLOR color, float thickness) {
+
+        // Outline centered on the edges, made up of four non overlapping bars
+        float t = (thickness > 0 ? thickness : 1) * 0.5f;
+        filledRect(x1 - t, y1 - t, x2 + t, y1 + t, color);
+        filledRect(x1 - t, y2 - t, x2 + t, y2 + t, color);
+
+        if (y1 + t < y2 - t) {
+            filledRect(x1 - t, y1 + t, x1 + t, y2 - t, color);
+            filledRect(x2 - t, y1 + t, x2 + t, y2 - t, color);
+        }
+
+    }
+
+    void filledRect(float x1, float y1, float x2, float y2, ALLEGRO_COLOR color) {
+        quad(x1, y1, x2, y1, x2, y2, x1, y2, color);
+    }
+
+    void flush() {
+
+        if (vertices->empty()) {
+            return;
+        }
+
+        al_draw_prim(&(*vertices)[0], NULL, NULL, 0, vertices->size(), ALLEGRO_PRIM_TRIANGLE_LIST);
+        stats.batches++;
+        vertices->clear();
+
+    }
+
+    void shutdown() {
+        debugMsg("render::prim", "Shutdown...");
+        delete vertices;
+    }
+
+}}}
+
@@ -0,0 +1,61 @@
+// Copyright (c) 2012 Ivo Wetzel.
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+#include "../Game.h"
+
+namespace Game { namespace render {
+
+    // Methods ----------------------------------------------------------------
+    void begin() {
+
+        stats.draws = 0;
+        stats.culled = 0;
+        stats.batches = 0;
+
+        transform::reset();
+
+    }
+
+    bool visible(float x1, float y1, float x2, float y2) {
+
+        // Test the world space bounds against the visible world rect
+        if (x2 <= graphics.viewX || x1 >= graphics.viewX + graphics.viewWidth
+            || y2 <= graphics.viewY || y1 >= graphics.viewY + graphics.viewHeight) {
+
+            stats.culled++;
+            return false;
+
+        } else {
+            stats.draws++;
+            return true;
+        }
+
+    }
+
+    void flush() {
+
+        // At most one of them has pending work, since each flushes the other
+        // before it starts buffering
+        batch::flush();
+        prim::flush();
+
+    }
+
+}}
+
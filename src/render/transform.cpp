@@ -0,0 +1,153 @@
+// Copyright (c) 2012 Ivo Wetzel.
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+#include "../Game.h"
+#include <algorithm>
+
+namespace Game { namespace render { namespace transform {
+
+    // Stack ------------------------------------------------------------------
+    typedef std::vector<ALLEGRO_TRANSFORM> TransformStack;
+    TransformStack *stack;
+
+    // Applies a local transformation before everything that's on the stack
+    void compose(const ALLEGRO_TRANSFORM &local) {
+        ALLEGRO_TRANSFORM t = local;
+        al_compose_transform(&t, &stack->back());
+        stack->back() = t;
+        apply();
+    }
+
+    void updateView(const ALLEGRO_TRANSFORM &current) {
+
+        // The visible world rect is the clipping rect mapped back through the
+        // inverse of the current transformation
+        ALLEGRO_TRANSFORM inverse = current;
+        al_invert_transform(&inverse);
+
+        int cx, cy, cw, ch;
+        al_get_clipping_rectangle(&cx, &cy, &cw, &ch);
+
+        float xs[4] = { (float)cx, (float)(cx + cw), (float)cx, (float)(cx + cw) };
+        float ys[4] = { (float)cy, (float)cy, (float)(cy + ch), (float)(cy + ch) };
+        for(int i = 0; i < 4; i++) {
+            al_transform_coordinates(&inverse, &xs[i], &ys[i]);
+        }
+
+        float x1 = std::min(std::min(xs[0], xs[1]), std::min(xs[2], xs[3]));
+        float y1 = std::min(std::min(ys[0], ys[1]), std::min(ys[2], ys[3]));
+        float x2 = std::max(std::max(xs[0], xs[1]), std::max(xs[2], xs[3]));
+        float y2 = std::max(std::max(ys[0], ys[1]), std::max(ys[2], ys[3]));
+
+        Game::graphics.viewX = x1;
+        Game::graphics.viewY = y1;
+        Game::graphics.viewWidth = x2 - x1;
+        Game::graphics.viewHeight = y2 - y1;
+
+    }
+
+
+    // Methods ----------------------------------------------------------------
+    void init() {
+        ALLEGRO_TRANSFORM t;
+        al_identity_transform(&t);
+        stack = new TransformStack();
+        stack->push_back(t);
+    }
+
+    void reset() {
+        ALLEGRO_TRANSFORM t;
+        al_identity_transform(&t);
+        stack->clear();
+        stack->push_back(t);
+        apply();
+    }
+
+    void apply() {
+
+        // Scripts may set up transformations before there's anything to draw to
+        if (!Game::state.running) {
+            return;
+        }
+
+        // Everything buffered so far was meant for the old transformation
+        render::flush();
+
+        // The render offset acts as the camera and is applied last
+        ALLEGRO_TRANSFORM current = stack->back();
+        al_translate_transform(&current, Game::graphics.offsetX, Game::graphics.offsetY);
+        al_use_transform(&current);
+        updateView(current);
+
+    }
+
+    void push() {
+        stack->push_back(stack->back());
+    }
+
+    unsigned int depth() {
+        return stack->size();
+    }
+
+    bool pop() {
+
+        if (stack->size() > 1) {
+            stack->pop_back();
+            apply();
+            return true;
+
+        } else {
+            return false;
+        }
+
+    }
+
+    void identity() {
+        al_identity_transform(&stack->back());
+        apply();
+    }
+
+    void translate(float x, float y) {
+        ALLEGRO_TRANSFORM t;
+        al_identity_transform(&t);
+        al_translate_transform(&t, x, y);
+        compose(t);
+    }
+
+    void scale(float x, float y) {
+        ALLEGRO_TRANSFORM t;
+        al_identity_transform(&t);
+        al_scale_transform(&t, x, y);
+        compose(t);
+    }
+
+    void rotate(float angle) {
+        ALLEGRO_TRANSFORM t;
+        al_identity_transform(&t);
+        al_rotate_transform(&t, angle);
+        compose(t);
+    }
+
+    void shutdown() {
+        debugMsg("render::transform", "Shutdown...");
+        delete stack;
+    }
+
+}}}
+
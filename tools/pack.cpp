@@ -0,0 +1,211 @@
+// Copyright (c) 2012 Ivo Wetzel.
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+#include "../src/io/archive.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+// Builds a WPAK archive from a game directory:
+//
+//   wombat-pack <directory> <archive>
+//
+// Names are stored relative to the directory, with / as the separator, which
+// is exactly how the game refers to its assets.
+
+typedef struct {
+    std::string name;
+    std::string path;
+    uint64_t size;
+
+} PackFile;
+
+typedef std::vector<PackFile> PackFileList;
+
+bool compareName(const PackFile &a, const PackFile &b) {
+    size_t min = std::min(a.name.length(), b.name.length());
+    int diff = memcmp(a.name.data(), b.name.data(), min);
+    return diff != 0 ? diff < 0 : a.name.length() < b.name.length();
+}
+
+bool isArchive(const std::string name) {
+    return name.length() >= 4 && name.compare(name.length() - 4, 4, ".pak") == 0;
+}
+
+bool collect(const std::string root, const std::string prefix, PackFileList &files) {
+
+    std::string dirname = prefix.length() ? root + "/" + prefix : root;
+    DIR *dir = opendir(dirname.data());
+    if (dir == NULL) {
+        fprintf(stderr, "Failed to open directory '%s'\n", dirname.data());
+        return false;
+    }
+
+    struct dirent *ent;
+    while((ent = readdir(dir)) != NULL) {
+
+        // Skip hidden files, . and ..
+        if (ent->d_name[0] == '.') {
+            continue;
+        }
+
+        std::string name = prefix.length() ? prefix + "/" + ent->d_name : ent->d_name;
+        std::string path = root + "/" + name;
+
+        struct stat info;
+        if (stat(path.data(), &info) != 0) {
+            continue;
+
+        } else if (S_ISDIR(info.st_mode)) {
+            if (!collect(root, name, files)) {
+                closedir(dir);
+                return false;
+            }
+
+        // Never pack other archives
+        } else if (S_ISREG(info.st_mode) && !isArchive(name)) {
+            PackFile file = { name, path, (uint64_t)info.st_size };
+            files.push_back(file);
+        }
+
+    }
+
+    closedir(dir);
+    return true;
+
+}
+
+uint64_t align(uint64_t offset) {
+    return (offset + ARCHIVE_ALIGN - 1) & ~(uint64_t)(ARCHIVE_ALIGN - 1);
+}
+
+bool copy(FILE *out, const PackFile &file) {
+
+    FILE *in = fopen(file.path.data(), "rb");
+    if (in == NULL) {
+        fprintf(stderr, "Failed to open '%s'\n", file.path.data());
+        return false;
+    }
+
+    char buffer[65536];
+    uint64_t total = 0;
+    size_t read;
+    while((read = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+        fwrite(buffer, 1, read, out);
+        total += read;
+    }
+
+    fclose(in);
+
+    if (total != file.size) {
+        fprintf(stderr, "Size of '%s' changed while packing\n", file.path.data());
+        return false;
+    }
+
+    return true;
+
+}
+
+int main(int argc, char* argv[]) {
+
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <directory> <archive>\n", argv[0]);
+        return 1;
+    }
+
+    PackFileList files;
+    if (!collect(argv[1], "", files)) {
+        return 1;
+    }
+
+    // The engine does a binary search over the names
+    std::sort(files.begin(), files.end(), compareName);
+
+    // Layout
+    uint32_t count = files.size();
+    uint64_t offset = sizeof(ArchiveHeader) + count * sizeof(ArchiveEntry);
+
+    std::vector<ArchiveEntry> entries(count);
+    for(uint32_t i = 0; i < count; i++) {
+        entries[i].name = (uint32_t)offset;
+        entries[i].nameLength = files[i].name.length();
+        offset += files[i].name.length();
+    }
+
+    for(uint32_t i = 0; i < count; i++) {
+        offset = align(offset);
+        entries[i].offset = offset;
+        entries[i].size = files[i].size;
+        entries[i].length = files[i].size;
+        entries[i].compression = ARCHIVE_COMPRESSION_NONE;
+        entries[i].reserved = 0;
+        offset += files[i].size;
+    }
+
+    // Write
+    FILE *out = fopen(argv[2], "wb");
+    if (out == NULL) {
+        fprintf(stderr, "Failed to create '%s'\n", argv[2]);
+        return 1;
+    }
+
+    ArchiveHeader header;
+    memcpy(header.magic, ARCHIVE_MAGIC, 4);
+    header.version = ARCHIVE_VERSION;
+    header.count = count;
+    header.reserved = 0;
+
+    fwrite(&header, sizeof(ArchiveHeader), 1, out);
+    if (count > 0) {
+        fwrite(&entries[0], sizeof(ArchiveEntry), count, out);
+    }
+
+    for(uint32_t i = 0; i < count; i++) {
+        fwrite(files[i].name.data(), 1, files[i].name.length(), out);
+    }
+
+    static const char padding[ARCHIVE_ALIGN] = { 0 };
+    for(uint32_t i = 0; i < count; i++) {
+
+        long position = ftell(out);
+        fwrite(padding, 1, (size_t)(entries[i].offset - position), out);
+
+        if (!copy(out, files[i])) {
+            fclose(out);
+            remove(argv[2]);
+            return 1;
+        }
+
+    }
+
+    if (fclose(out) != 0) {
+        fprintf(stderr, "Failed to write '%s'\n", argv[2]);
+        return 1;
+    }
+
+    printf("Packed %u file(s) into '%s', %llu bytes\n", count, argv[2], (unsigned long long)offset);
+    return 0;
+
+}
+